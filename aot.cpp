@@ -0,0 +1,711 @@
+#include "chip8.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdarg>
+#include <string>
+#include <vector>
+
+//Ahead-of-time compiler. Follows a ROM's control flow from PROGRAM_START and writes out a C++ translation unit with
+//every block it can reach compiled to straight C++. The generated file defines
+//
+//    void runCompiledRom(Chip8 & c, int n);
+//
+//which does the same thing as c.runCycles(n) and registers itself as the Chip8::Backend::Compiled backend. Link it with
+//the core and select that backend (--backend=compiled in the frontend); the "Build CHIP-8 with a compiled ROM" task does
+//this. Anything the compiler can't see statically falls back to the interpreter at run time: computed jumps (BNNN) go
+//through a dispatch on the program counter, addresses that weren't compiled are interpreted one instruction at a time, and
+//if the ROM overwrites its own code (or a different ROM is loaded) the whole batch is handed to runInterpreted
+//
+//Quirk flags are parsed by the core (parseQuirkFlags), the same as in the frontend, so aot links against libchip8.a
+//
+//Usage: aot <ROM> [-lrosd] [--out=output.cpp]
+
+//Longest run of instructions put in one block. A block only runs compiled if the whole block fits in what's left of the
+//batch, otherwise the interpreter finishes the batch, so blocks are kept short next to the default ~11 instructions a
+//frame
+const int AOT_BLOCK_LENGTH = 8;
+
+unsigned char rom [MEMORY_SIZE];
+//Set for every address an instruction was reached at
+bool reached [MEMORY_SIZE];
+//Set for every address a block has to start at: the entry point and anything jumped, skipped, called or returned to
+bool leader [MEMORY_SIZE];
+//Set while the blocks are written for each temporary and helper they use, so the generated file only declares those and
+//builds cleanly with -Wall
+bool needsPrev, needsIndex, needsTouchesCode, needsDrawSprite;
+
+unsigned short opcodeAt(int address) {
+
+    return (rom[address] << 8) | rom[address + 1];
+
+}
+
+//Same as endsBlock in chip8.cpp: instructions that can send the program counter somewhere other than the next instruction
+bool isTerminator(unsigned short opcode) {
+
+    switch (opcode >> 12) {
+
+        case 0x0:
+            return opcode == 0x00EE;
+        case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x9: case 0xB: case 0xE:
+            return true;
+        case 0xF:
+            return (opcode & 0xFF) == 0x0A || (opcode & 0xFF) == 0x33 || (opcode & 0xFF) == 0x55;
+        default:
+            return false;
+
+    }
+
+}
+
+//FX33 and FX55 are the only instructions that write to memory
+bool isStore(unsigned short opcode) {
+
+    return (opcode >> 12) == 0xF && ((opcode & 0xFF) == 0x33 || (opcode & 0xFF) == 0x55);
+
+}
+
+//Where the program can go after the instruction at address. Computed jumps and returns have no static successors
+std::vector<int> successors(int address) {
+
+    unsigned short opcode = opcodeAt(address);
+
+    if (!isTerminator(opcode)) return {address + 2};
+
+    switch (opcode >> 12) {
+
+        case 0x1:
+            return {opcode & 0xFFF};
+        case 0x2:
+            return {opcode & 0xFFF, address + 2};
+        case 0x3: case 0x4: case 0x5: case 0x9: case 0xE:
+            return {address + 2, address + 4};
+        case 0xF:
+            return {address + 2};
+        default:
+            return {};
+
+    }
+
+}
+
+//Walks every path from the entry point, marking the instructions it finds and the addresses blocks must start at
+void discover() {
+
+    std::vector<int> pending = {PROGRAM_START};
+    leader[PROGRAM_START] = true;
+
+    while (!pending.empty()) {
+
+        int address = pending.back();
+        pending.pop_back();
+
+        //Instructions straddling the end of memory are left to the interpreter
+        if (address + 1 >= MEMORY_SIZE || reached[address]) continue;
+
+        reached[address] = true;
+
+        for (int next : successors(address)) {
+
+            if (next + 1 >= MEMORY_SIZE) continue;
+
+            if (isTerminator(opcodeAt(address))) leader[next] = true;
+            pending.push_back(next);
+
+        }
+
+    }
+
+}
+
+//printf onto the end of code
+void append(std::string & code, const char * format, ...) {
+
+    char text [256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    code += text;
+
+}
+
+std::string hex(int value) {
+
+    char text [8];
+    snprintf(text, sizeof(text), "%03X", value);
+    return text;
+
+}
+
+std::string reg(int index) {
+
+    char text [24];
+    snprintf(text, sizeof(text), "c.registers[0x%X]", index);
+    return text;
+
+}
+
+//Jumps to address: straight to its block if it has one, otherwise through the dispatch
+std::string jumpTo(int address) {
+
+    if (address + 1 < MEMORY_SIZE && leader[address] && reached[address]) {
+
+        return "goto block" + hex(address) + ";";
+
+    }
+
+    return "{ c.programCounter = 0x" + hex(address) + "; goto dispatch; }";
+
+}
+
+//Writes the C++ for one instruction. Returns false if the interpreter has to run it instead
+bool emitInstruction(std::string & code, int address, int quirks) {
+
+    unsigned short opcode = opcodeAt(address);
+    int nnn = opcode & 0xFFF, x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF, n = opcode & 0xF, nn = opcode & 0xFF;
+    std::string vx = reg(x), vy = reg(y), vf = reg(0xF);
+
+    append(code, "    //%04X\n", opcode);
+
+    switch (opcode >> 12) {
+
+        case 0x0:
+            if (opcode == 0x00E0) {
+
+                append(code, "    for (int y = 0; y < DISPLAY_HEIGHT; y++) {\n\n");
+                append(code, "        if (c.display[y]) c.dirtyRows |= 1u << y;\n\n");
+                append(code, "    }\n\n");
+                append(code, "    std::fill_n(c.display, DISPLAY_HEIGHT, 0);\n");
+
+            }
+            else if (opcode == 0x00EE) {
+
+                append(code, "    c.stackIndex--;\n");
+                append(code, "    c.programCounter = c.stack[c.stackIndex & 0xF];\n");
+                append(code, "    goto dispatch;\n");
+
+            }
+            //Everything else in the 0 group is a machine language routine, which is ignored
+            return true;
+        case 0x1:
+            append(code, "    %s\n", jumpTo(nnn).c_str());
+            return true;
+        case 0x2:
+            append(code, "    if (c.stackIndex > 15) {\n\n");
+            append(code, "        if (!c.quiet) printf(\"Error: stack overflow\\n\");\n");
+            append(code, "        c.programCounter = 0x%s;\n", hex(address + 2).c_str());
+            append(code, "        c.running = false;\n");
+            append(code, "        goto dispatch;\n\n");
+            append(code, "    }\n");
+            append(code, "    c.stack[c.stackIndex & 0xF] = 0x%s;\n", hex(address + 2).c_str());
+            append(code, "    c.stackIndex++;\n");
+            append(code, "    %s\n", jumpTo(nnn).c_str());
+            return true;
+        case 0x3: case 0x4: case 0x5: case 0x9: {
+
+            std::string compare = ((opcode >> 12) == 0x3 || (opcode >> 12) == 0x5) ? "==" : "!=";
+            std::string operand = ((opcode >> 12) == 0x3 || (opcode >> 12) == 0x4) ? std::to_string(nn) : vy;
+            append(code, "    if (%s %s %s) %s\n", vx.c_str(), compare.c_str(), operand.c_str(), jumpTo(address + 4).c_str());
+            append(code, "    %s\n", jumpTo(address + 2).c_str());
+            return true;
+
+        }
+        case 0x6:
+            append(code, "    %s = %d;\n", vx.c_str(), nn);
+            return true;
+        case 0x7:
+            append(code, "    %s += %d;\n", vx.c_str(), nn);
+            return true;
+        case 0x8:
+            switch (n) {
+
+                case 0x0:
+                    append(code, "    %s = %s;\n", vx.c_str(), vy.c_str());
+                    return true;
+                case 0x1: case 0x2: case 0x3:
+                    append(code, "    %s %s= %s;\n", vx.c_str(), (n == 1) ? "|" : (n == 2) ? "&" : "^", vy.c_str());
+                    return true;
+                case 0x4:
+                    needsPrev = true;
+                    append(code, "    prev = %s;\n", vx.c_str());
+                    append(code, "    %s += %s;\n", vx.c_str(), vy.c_str());
+                    append(code, "    %s = prev > %s;\n", vf.c_str(), vx.c_str());
+                    return true;
+                case 0x5:
+                    needsPrev = true;
+                    append(code, "    prev = %s;\n", vx.c_str());
+                    append(code, "    %s -= %s;\n", vx.c_str(), vy.c_str());
+                    append(code, "    %s = prev >= %s;\n", vf.c_str(), vy.c_str());
+                    return true;
+                case 0x6:
+                    needsPrev = true;
+                    if (quirks & QUIRK_RIGHT_SHIFT) append(code, "    %s = %s;\n", vx.c_str(), vy.c_str());
+                    append(code, "    prev = %s;\n", vx.c_str());
+                    append(code, "    %s >>= 1;\n", vx.c_str());
+                    append(code, "    %s = prev & 1;\n", vf.c_str());
+                    return true;
+                case 0x7:
+                    needsPrev = true;
+                    append(code, "    prev = %s;\n", vx.c_str());
+                    append(code, "    %s = %s - %s;\n", vx.c_str(), vy.c_str(), vx.c_str());
+                    append(code, "    %s = prev <= %s;\n", vf.c_str(), vy.c_str());
+                    return true;
+                case 0xE:
+                    needsPrev = true;
+                    if (quirks & QUIRK_LEFT_SHIFT) append(code, "    %s = %s;\n", vx.c_str(), vy.c_str());
+                    append(code, "    prev = %s;\n", vx.c_str());
+                    append(code, "    %s <<= 1;\n", vx.c_str());
+                    append(code, "    %s = prev >> 7;\n", vf.c_str());
+                    return true;
+                default:
+                    //Invalid; ignored
+                    return true;
+
+            }
+        case 0xA:
+            append(code, "    c.indexRegister = 0x%s;\n", hex(nnn).c_str());
+            return true;
+        case 0xB:
+            append(code, "    c.programCounter = 0x%s + %s;\n", hex(nnn).c_str(),
+                reg((quirks & QUIRK_OFFSET_JMP) ? 0 : x).c_str());
+            append(code, "    goto dispatch;\n");
+            return true;
+        case 0xD:
+            needsDrawSprite = true;
+            append(code, "    drawSprite(c, %s, %s, %d);\n", vx.c_str(), vy.c_str(), n);
+            return true;
+        case 0xE:
+            if (nn == 0x9E || nn == 0xA1) {
+
+                append(code, "    if (%s((c.keys >> (%s & 0xF)) & 1)) %s\n", (nn == 0xA1) ? "!" : "", vx.c_str(),
+                    jumpTo(address + 4).c_str());
+                append(code, "    %s\n", jumpTo(address + 2).c_str());
+                return true;
+
+            }
+            break;
+        case 0xF:
+            switch (nn) {
+
+                case 0x07:
+                    append(code, "    %s = c.delayTimer;\n", vx.c_str());
+                    return true;
+                case 0x15:
+                    append(code, "    c.delayTimer = %s;\n", vx.c_str());
+                    return true;
+                case 0x18:
+                    append(code, "    c.soundTimer = %s;\n", vx.c_str());
+                    return true;
+                case 0x1E:
+                    needsIndex = true;
+                    append(code, "    index = c.indexRegister;\n");
+                    append(code, "    c.indexRegister += %s;\n", vx.c_str());
+                    append(code, "    %s = index > c.indexRegister;\n", vf.c_str());
+                    return true;
+                case 0x29:
+                    append(code, "    c.indexRegister = FONT_START + (%s & 0xF) * 5;\n", vx.c_str());
+                    return true;
+                case 0x65:
+                    for (int i = 0; i <= x; i++) {
+
+                        append(code, "    %s = c.memory[(c.indexRegister + %d) & 0xFFF];\n", reg(i).c_str(), i);
+
+                    }
+                    if (quirks & QUIRK_LOAD) append(code, "    c.indexRegister += %d;\n", x);
+                    return true;
+
+            }
+            break;
+
+    }
+
+    //CXNN needs the core's random number generator, FX0A can wait on itself and FX33/FX55 write through the core so its
+    //caches stay coherent. Anything else left is invalid and ignored; the interpreter does that too
+    append(code, "    //Interpreted\n");
+    return false;
+
+}
+
+//Splits the reached code into blocks. A block runs from a leader up to the first terminator, the next leader or
+//AOT_BLOCK_LENGTH instructions, whichever comes first. Where a block is cut short the next instruction becomes a leader too
+void splitBlocks() {
+
+    for (int address = 0; address + 1 < MEMORY_SIZE; address++) {
+
+        if (!leader[address] || !reached[address]) continue;
+
+        int length = 1;
+
+        for (int next = address + 2; next + 1 < MEMORY_SIZE && reached[next] && !leader[next]; next += 2) {
+
+            if (isTerminator(opcodeAt(next - 2))) break;
+
+            if (length == AOT_BLOCK_LENGTH) {
+
+                leader[next] = true;
+                break;
+
+            }
+
+            length++;
+
+        }
+
+    }
+
+}
+
+//Writes the block starting at start
+void emitBlock(std::string & code, int start, int quirks) {
+
+    std::vector<int> addresses = {start};
+
+    while (!isTerminator(opcodeAt(addresses.back()))) {
+
+        int next = addresses.back() + 2;
+        if (next + 1 >= MEMORY_SIZE || !reached[next] || leader[next]) break;
+        addresses.push_back(next);
+
+    }
+
+    append(code, "block%s:\n", hex(start).c_str());
+
+    //FX07 3X00 1NNN jumping back to itself only polls the delay timer. The timer doesn't change inside a batch so if it
+    //isn't 0 yet the rest of the batch is spent here
+    unsigned short first = opcodeAt(start);
+    int x = (first >> 8) & 0xF;
+
+    if (start + 5 < MEMORY_SIZE && (first & 0xF0FF) == 0xF007 && opcodeAt(start + 2) == (0x3000 | (x << 8)) &&
+        opcodeAt(start + 4) == (0x1000 | start)) {
+
+        append(code, "    if (c.delayTimer > 0) {\n\n");
+        append(code, "        c.programCounter = 0x%s + 2 * ((n - i) %% 3);\n", hex(start).c_str());
+        append(code, "        %s = c.delayTimer;\n", reg(x).c_str());
+        append(code, "        c.instructionCount += n - i;\n");
+        append(code, "        c.idleInstructions += n - i;\n");
+        append(code, "        return;\n\n");
+        append(code, "    }\n");
+
+    }
+
+    //Only run the compiled block if all of it fits in the batch
+    int length = addresses.size();
+    append(code, "    if (n - i < %d) { c.programCounter = 0x%s; goto interpret; }\n", length, hex(start).c_str());
+    append(code, "    i += %d;\n", length);
+
+    //Interpreted instructions count themselves, so the block only counts the rest
+    int compiled = 0;
+    std::string body;
+
+    for (int at : addresses) {
+
+        unsigned short opcode = opcodeAt(at);
+
+        if (emitInstruction(body, at, quirks)) {
+
+            compiled++;
+            continue;
+
+        }
+
+        append(body, "    c.programCounter = 0x%s;\n", hex(at).c_str());
+
+        if (isStore(opcode)) {
+
+            //If the store hit compiled code the compiled blocks are stale, so the interpreter finishes the batch
+            int count = ((opcode & 0xFF) == 0x33) ? 3 : ((opcode >> 8) & 0xF) + 1;
+            needsIndex = needsTouchesCode = true;
+            append(body, "    index = c.indexRegister;\n");
+            append(body, "    c.step();\n");
+            append(body, "    if (touchesCode(index, %d) && !codeIntact(c)) goto interpret;\n", count);
+
+        }
+        else {
+
+            append(body, "    c.step();\n");
+
+        }
+
+        //FX0A that is still waiting for a key leaves the program counter on itself. runInterpreted skips the rest of the batch
+        if ((opcode & 0xF0FF) == 0xF00A) {
+
+            append(body, "    if (c.programCounter == 0x%s) goto interpret;\n", hex(at).c_str());
+
+        }
+
+    }
+
+    //Blocks that don't end in a jump carry on into the next one
+    unsigned short last = opcodeAt(addresses.back());
+
+    if (!isTerminator(last) || isStore(last) || (last & 0xF0FF) == 0xF00A) {
+
+        append(body, "    %s\n", jumpTo(addresses.back() + 2).c_str());
+
+    }
+
+    if (compiled > 0) append(code, "    c.instructionCount += %d;\n", compiled);
+
+    code += body + "\n";
+
+}
+
+//Writes the byte array for one run of compiled code
+void emitCodeRange(FILE * out, int start, int end) {
+
+    fprintf(out, "static const unsigned char code%s [] = {", hex(start).c_str());
+
+    for (int i = start; i < end; i++) {
+
+        fprintf(out, "%s0x%02X", ((i - start) % 16 == 0) ? "\n    " : " ", rom[i]);
+        if (i + 1 < end) fprintf(out, ",");
+
+    }
+
+    fprintf(out, "\n};\n");
+
+}
+
+void emit(FILE * out, const char * path, int quirks) {
+
+    //The blocks are written first so it's known which helpers and temporaries they need
+    std::string code;
+
+    for (int i = 0; i + 1 < MEMORY_SIZE; i++) {
+
+        if (leader[i] && reached[i]) emitBlock(code, i, quirks);
+
+    }
+
+    //Every byte an instruction was compiled from
+    std::vector<bool> isCode(MEMORY_SIZE, false);
+
+    for (int i = 0; i < MEMORY_SIZE; i++) {
+
+        if (reached[i]) isCode[i] = isCode[i + 1] = true;
+
+    }
+
+    fprintf(out, "//Generated by aot from %s. Do not edit\n", path);
+    fprintf(out, "#include \"chip8.h\"\n");
+    fprintf(out, "#include <cstdio>\n");
+    fprintf(out, "#include <cstring>\n");
+    fprintf(out, "#include <algorithm>\n\n");
+    fprintf(out, "//Quirk set the ROM was compiled for. Any other set runs in the interpreter\n");
+    fprintf(out, "static const int COMPILED_QUIRKS = %d;\n\n", quirks);
+
+    //The original code, split into runs, so run time can check nothing was overwritten
+    std::vector<std::pair<int, int>> ranges;
+
+    for (int i = 0; i < MEMORY_SIZE; i++) {
+
+        if (!isCode[i]) continue;
+
+        int start = i;
+        while (i < MEMORY_SIZE && isCode[i]) i++;
+        ranges.push_back({start, i});
+        emitCodeRange(out, start, i);
+
+    }
+
+    fprintf(out, "\nstruct CodeRange {\n\n");
+    fprintf(out, "    unsigned short address, length;\n");
+    fprintf(out, "    const unsigned char * bytes;\n\n");
+    fprintf(out, "};\n\n");
+    fprintf(out, "static const CodeRange codeRanges [] = {\n");
+
+    for (auto & range : ranges) {
+
+        fprintf(out, "    {0x%s, %d, code%s},\n", hex(range.first).c_str(), range.second - range.first,
+            hex(range.first).c_str());
+
+    }
+
+    fprintf(out, "};\n\n");
+
+    //Bitmap of the same bytes for quickly checking whether a store hit code
+    fprintf(out, "static const unsigned char codeMap [MEMORY_SIZE / 8] = {");
+
+    for (int i = 0; i < MEMORY_SIZE / 8; i++) {
+
+        int bits = 0;
+
+        for (int j = 0; j < 8; j++) {
+
+            bits |= isCode[i * 8 + j] << j;
+
+        }
+
+        fprintf(out, "%s0x%02X%s", (i % 16 == 0) ? "\n    " : " ", bits, (i + 1 < MEMORY_SIZE / 8) ? "," : "");
+
+    }
+
+    fprintf(out, "\n};\n\n");
+
+    //Run time helpers
+    fprintf(out, "%s",
+        "//True if memory still holds the code that was compiled\n"
+        "static bool codeIntact(const Chip8 & c) {\n\n"
+        "    for (const CodeRange & range : codeRanges) {\n\n"
+        "        if (std::memcmp(c.memory + range.address, range.bytes, range.length) != 0) return false;\n\n"
+        "    }\n\n"
+        "    return true;\n\n"
+        "}\n\n");
+
+    if (needsTouchesCode) {
+
+        fprintf(out, "%s",
+            "//True if any of the length bytes from address are compiled code\n"
+            "static bool touchesCode(unsigned short address, int length) {\n\n"
+            "    for (int i = 0; i < length; i++) {\n\n"
+            "        int at = (address + i) & 0xFFF;\n"
+            "        if ((codeMap[at >> 3] >> (at & 7)) & 1) return true;\n\n"
+            "    }\n\n"
+            "    return false;\n\n"
+            "}\n\n");
+
+    }
+
+    if (needsDrawSprite) {
+
+        fprintf(out, "%s",
+            "//DXYN, exactly like the interpreter's\n"
+            "static void drawSprite(Chip8 & c, unsigned int xCoord, unsigned int yCoord, unsigned int height) {\n\n"
+            "    xCoord &= 63;\n"
+            "    yCoord &= 31;\n"
+            "    c.registers[0xF] = 0;\n\n"
+            "    for (unsigned int i = 0; i < height; i++) {\n\n"
+            "        if (yCoord + i > 31) break;\n\n"
+            "        uint64_t spriteRow = (uint64_t)c.memory[(c.indexRegister + i) & 0xFFF] << (DISPLAY_WIDTH - 8) >> xCoord;\n\n"
+            "        if (c.display[yCoord + i] & spriteRow) c.registers[0xF] = 1;\n"
+            "        c.display[yCoord + i] ^= spriteRow;\n"
+            "        if (spriteRow) c.dirtyRows |= 1u << (yCoord + i);\n\n"
+            "    }\n\n"
+            "}\n\n");
+
+    }
+
+    fprintf(out, "%s",
+        "//Executes n instructions without touching the timers, the same as c.runCycles(n)\n"
+        "void runCompiledRom(Chip8 & c, int n) {\n\n"
+        "    if (c.quirks() != COMPILED_QUIRKS || !codeIntact(c)) {\n\n"
+        "        c.runInterpreted(n);\n"
+        "        return;\n\n"
+        "    }\n\n"
+        "    int i = 0;\n");
+
+    if (needsPrev) fprintf(out, "    unsigned char prev;\n");
+    if (needsIndex) fprintf(out, "    unsigned short index;\n");
+
+    fprintf(out, "%s",
+        "\n"
+        "dispatch:\n"
+        "    if (i >= n) return;\n\n"
+        "    if (!c.running) {\n\n"
+        "        c.instructionCount += n - i;\n"
+        "        return;\n\n"
+        "    }\n\n"
+        "    switch (c.programCounter) {\n\n");
+
+    for (int i = 0; i < MEMORY_SIZE; i++) {
+
+        if (leader[i] && reached[i]) {
+
+            fprintf(out, "        case 0x%s: goto block%s;\n", hex(i).c_str(), hex(i).c_str());
+
+        }
+
+    }
+
+    fprintf(out, "%s",
+        "        default: break;\n\n"
+        "    }\n\n"
+        "    //Nothing was compiled here\n"
+        "    c.step();\n"
+        "    i++;\n"
+        "    goto dispatch;\n\n"
+        "interpret:\n"
+        "    c.runInterpreted(n - i);\n"
+        "    return;\n\n");
+
+    fputs(code.c_str(), out);
+    fprintf(out, "}\n\n");
+    fprintf(out, "static const bool registered = Chip8::registerCompiledRom(runCompiledRom);\n");
+
+}
+
+int main(int argc, char * argv []) {
+
+    if (argc < 2) {
+
+        printf("Usage: %s <ROM> [-lrosd] [--out=output.cpp]\n", argv[0]);
+        return 1;
+
+    }
+
+    int quirks = 0;
+    const char * outPath = nullptr;
+
+    for (int i = 2; i < argc; i++) {
+
+        std::string flag = argv[i];
+
+        if (flag.rfind("--out=", 0) == 0) {
+
+            outPath = argv[i] + 6;
+
+        }
+        else if (!parseQuirkFlags(argv[i], quirks)) {
+
+            printf("Invalid flag: %s. Option will be ignored. Prepend '-'\n", flag.c_str());
+
+        }
+
+    }
+
+    FILE * in = fopen(argv[1], "rb");
+
+    if (in == NULL) {
+
+        printf("Error: ROM could not be opened. Please make sure the file path is correct.\n");
+        return 1;
+
+    }
+
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    //Anything that doesn't fit in program space is dropped, the same as Chip8::loadRom. Reading less than that would
+    //compile a zero filled tail that doesn't match the ROM the core loads
+    size_t expected = (size_t) std::max(0L, std::min(size, (long) (MEMORY_SIZE - PROGRAM_START)));
+    size_t read = fread(rom + PROGRAM_START, 1, expected, in);
+    fclose(in);
+
+    if (size < 0 || read != expected) {
+
+        printf("Error: ROM could not be read.\n");
+        return 1;
+
+    }
+
+    discover();
+    splitBlocks();
+
+    FILE * out = (outPath != nullptr) ? fopen(outPath, "w") : stdout;
+
+    if (out == NULL) {
+
+        printf("Error: could not open %s for writing\n", outPath);
+        return 1;
+
+    }
+
+    emit(out, argv[1], quirks);
+
+    if (out != stdout) fclose(out);
+
+    return 0;
+
+}
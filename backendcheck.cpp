@@ -0,0 +1,160 @@
+#include "chip8.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+//Backend equivalence check. Runs every bundled ROM on every backend under each timing model, with and without the quirks,
+//and fails if any backend ends up in a different state than the Switch backend (the portable reference). Keys are
+//pressed on a fixed schedule and the random seed is fixed, the same as in bench, so every run executes the same program.
+//The Compiled backend is only checked if a compiled ROM is linked in. It runs whichever ROM is loaded, handing anything
+//it wasn't compiled from to the interpreter
+//
+//Usage: backendcheck [--frames=N]
+//Run it from the folder the ROMs are in. Prints every mismatch and exits with 1 if there were any
+
+const char * const CHECK_ROMS [] = {
+    "PONG", "TETRIS", "CAVE", "TANK", "Maze", "IBM Logo.ch8", "BC_test.ch8", "test_opcode.ch8", "3-corax+.ch8",
+    "4-flags.ch8"
+};
+
+const Chip8::Backend CHECK_BACKENDS [] = {
+    Chip8::Backend::Table, Chip8::Backend::Cached, Chip8::Backend::Block, Chip8::Backend::Jit, Chip8::Backend::Threaded,
+    Chip8::Backend::Compiled
+};
+
+const char * const BACKEND_NAMES [] = {"switch", "table", "cached", "block", "jit", "threaded", "compiled"};
+
+const Chip8::Timing CHECK_TIMINGS [] = {Chip8::Timing::Frame, Chip8::Timing::Flat, Chip8::Timing::Vip};
+
+const char * const TIMING_NAMES [] = {"frame", "flat", "vip"};
+
+//Instructions per frame for the Frame timing model. The default rate and one high enough that most batches run into the
+//idle skip and the block and JIT paths get long runs
+const int CHECK_CYCLES [] = {700 / 60, 500};
+
+//Frames run per ROM when --frames isn't given
+const int DEFAULT_CHECK_FRAMES = 3000;
+
+//Runs rom for frames frames and leaves the final state in chip8. Returns false if the ROM couldn't be loaded
+bool runRom(Chip8 & chip8, const char * rom, Chip8::Backend backend, Chip8::Timing timing, int quirks, int cycles,
+    int frames) {
+
+    chip8.backend = backend;
+    chip8.timing = timing;
+    chip8.cyclesPerFrame = cycles;
+    chip8.setQuirks(quirks);
+
+    if (!chip8.loadRom(rom)) return false;
+
+    chip8.seedRandom(1234);
+
+    for (int frame = 0; frame < frames && chip8.running; frame++) {
+
+        //For 37 frames out of every 185 a key is held, moving on to the next key every 11 frames
+        chip8.setKeys((frame / 37) % 5 == 0 ? (1u << ((frame / 11) % 16)) : 0);
+        chip8.runFrame();
+
+    }
+
+    return true;
+
+}
+
+//Names the first part of the machine state that differs, or returns nullptr if a and b are the same
+const char * stateDifference(const Chip8 & a, const Chip8 & b) {
+
+    if (std::memcmp(a.memory, b.memory, sizeof(a.memory)) != 0) return "memory";
+    if (std::memcmp(a.display, b.display, sizeof(a.display)) != 0) return "display";
+    if (std::memcmp(a.registers, b.registers, sizeof(a.registers)) != 0) return "registers";
+    if (a.indexRegister != b.indexRegister) return "index register";
+    if (std::memcmp(a.stack, b.stack, sizeof(a.stack)) != 0 || a.stackIndex != b.stackIndex) return "stack";
+    if (a.programCounter != b.programCounter) return "program counter";
+    if (a.delayTimer != b.delayTimer || a.soundTimer != b.soundTimer) return "timers";
+    if (a.running != b.running) return "running";
+    if (a.instructionCount != b.instructionCount) return "instruction count";
+
+    return nullptr;
+
+}
+
+int main(int argc, char * argv []) {
+
+    int frames = DEFAULT_CHECK_FRAMES;
+
+    for (int i = 1; i < argc; i++) {
+
+        if (std::strncmp(argv[i], "--frames=", 9) == 0) {
+
+            frames = std::max(1, atoi(argv[i] + 9));
+
+        }
+        else {
+
+            printf("Invalid flag: %s. Option will be ignored\n", argv[i]);
+
+        }
+
+    }
+
+    if (!Chip8::hasCompiledRom()) {
+
+        printf("No compiled ROM is linked in (see aot.cpp). The compiled backend won't be checked\n");
+
+    }
+
+    Chip8 reference;
+    Chip8 chip8;
+    int runs = 0, failures = 0;
+
+    for (const char * rom : CHECK_ROMS) {
+
+        for (int quirks : {0, QUIRK_SET_COUNT - 1}) {
+
+            for (int t = 0; t < 3; t++) {
+
+                for (int cycles : CHECK_CYCLES) {
+
+                    //cyclesPerFrame only matters to the Frame timing model
+                    if (CHECK_TIMINGS[t] != Chip8::Timing::Frame && cycles != CHECK_CYCLES[0]) continue;
+
+                    if (!runRom(reference, rom, Chip8::Backend::Switch, CHECK_TIMINGS[t], quirks, cycles, frames)) {
+
+                        printf("Error: %s could not be opened. Run the check from the folder the ROMs are in.\n", rom);
+                        return 1;
+
+                    }
+
+                    for (Chip8::Backend backend : CHECK_BACKENDS) {
+
+                        if (backend == Chip8::Backend::Compiled && !Chip8::hasCompiledRom()) continue;
+
+                        runRom(chip8, rom, backend, CHECK_TIMINGS[t], quirks, cycles, frames);
+                        runs++;
+
+                        const char * difference = stateDifference(reference, chip8);
+
+                        if (difference != nullptr) {
+
+                            printf("FAIL %s %s --backend=%s --timing=%s --cycles=%d: %s differs from the switch backend\n",
+                                rom, quirks ? "-lrosd" : "-LROSD", BACKEND_NAMES[(int)backend], TIMING_NAMES[t], cycles,
+                                difference);
+                            failures++;
+
+                        }
+
+                    }
+
+                }
+
+            }
+
+        }
+
+    }
+
+    printf("%d of %d runs matched the switch backend over %d frames\n", runs - failures, runs, frames);
+
+    return (failures > 0) ? 1 : 0;
+
+}
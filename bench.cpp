@@ -0,0 +1,163 @@
+#include "chip8.h"
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+//Headless benchmark. Runs a ROM for a fixed number of frames as fast as possible on the given backend and prints how fast
+//it went, plus a hash of the final machine state so runs on different backends can be checked against each other. Keys
+//are pressed on a fixed schedule so ROMs that wait for input still get somewhere, and the random seed is fixed, so two
+//runs with the same arguments execute exactly the same instructions
+//
+//Usage: bench <ROM> [-lrosd] [--backend=switch|table|cached|block|jit|threaded|compiled] [--timing=frame|flat|vip]
+//       [--frames=N] [--cycles=N]
+
+//Frames run when --frames isn't given (a little under an hour of emulated time)
+const int DEFAULT_BENCH_FRAMES = 200000;
+
+//FNV-1a over the machine state
+unsigned long long hashState(const Chip8State & state) {
+
+    const unsigned char * bytes = (const unsigned char *)&state;
+    unsigned long long hash = 1469598103934665603ULL;
+
+    for (size_t i = 0; i < sizeof(Chip8State); i++) {
+
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+
+    }
+
+    return hash;
+
+}
+
+int main(int argc, char * argv []) {
+
+    if (argc < 2) {
+
+        printf("Usage: %s <ROM> [-lrosd] [--backend=switch|table|cached|block|jit|threaded|compiled] [--timing=frame|flat|vip] [--frames=N] [--cycles=N]\n", argv[0]);
+        return 1;
+
+    }
+
+    Chip8 chip8;
+    int frames = DEFAULT_BENCH_FRAMES;
+    int quirks = 0;
+
+    std::unordered_map<std::string, Chip8::Backend> backends = {
+        {"switch", Chip8::Backend::Switch}, {"table", Chip8::Backend::Table}, {"cached", Chip8::Backend::Cached},
+        {"block", Chip8::Backend::Block}, {"jit", Chip8::Backend::Jit}, {"threaded", Chip8::Backend::Threaded},
+        {"compiled", Chip8::Backend::Compiled}
+    };
+
+    std::unordered_map<std::string, Chip8::Timing> timings = {
+        {"frame", Chip8::Timing::Frame}, {"flat", Chip8::Timing::Flat}, {"vip", Chip8::Timing::Vip}
+    };
+
+    for (int i = 2; i < argc; i++) {
+
+        std::string flag = argv[i];
+        if (flag.rfind("--backend=", 0) == 0) {
+
+            std::string name = flag.substr(10);
+            if (backends.find(name) != backends.end()) {
+
+                chip8.backend = backends[name];
+
+            }
+            else {
+
+                printf("Invalid backend: %s. Option will be ignored\n", name.c_str());
+
+            }
+
+        }
+        else if (flag.rfind("--timing=", 0) == 0) {
+
+            std::string name = flag.substr(9);
+            if (timings.find(name) != timings.end()) {
+
+                chip8.timing = timings[name];
+
+            }
+            else {
+
+                printf("Invalid timing: %s. Option will be ignored\n", name.c_str());
+
+            }
+
+        }
+        else if (flag.rfind("--frames=", 0) == 0) {
+
+            frames = std::max(1, atoi(flag.c_str() + 9));
+
+        }
+        else if (flag.rfind("--cycles=", 0) == 0) {
+
+            chip8.cyclesPerFrame = std::max(1, atoi(flag.c_str() + 9));
+
+        }
+        else if (!parseQuirkFlags(argv[i], quirks)) {
+
+            printf("Invalid flag: %s. Option will be ignored. Prepend '-'\n", flag.c_str());
+
+        }
+
+    }
+
+    chip8.setQuirks(quirks);
+
+    if (chip8.backend == Chip8::Backend::Compiled && !Chip8::hasCompiledRom()) {
+
+        printf("No compiled ROM is linked in (see aot.cpp). Using the cached backend\n");
+        chip8.backend = Chip8::Backend::Cached;
+
+    }
+
+    if (!chip8.loadRom(argv[1])) {
+
+        printf("Error: ROM could not be opened. Please make sure the file path is correct.\n");
+        return 1;
+
+    }
+
+    chip8.seedRandom(1234);
+
+    auto start = std::chrono::steady_clock::now();
+    int frame = 0;
+
+    for (; frame < frames && chip8.running; frame++) {
+
+        //For 37 frames out of every 185 a key is held, moving on to the next key every 11 frames
+        chip8.setKeys((frame / 37) % 5 == 0 ? (1u << ((frame / 11) % 16)) : 0);
+        chip8.runFrame();
+
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double rate = (seconds > 0) ? chip8.instructionCount / seconds : 0;
+
+    printf("%s: %d frames, %llu instructions in %.1f ms\n", argv[1], frame, chip8.instructionCount, seconds * 1000);
+    printf("    %.2f million instructions/s, %.0fx real time, %.2f%% idle\n", rate / 1000000, frame / 60.0 / seconds,
+        (chip8.instructionCount > 0) ? 100.0 * chip8.idleInstructions / chip8.instructionCount : 0);
+
+    //Only the Block backend fuses instructions
+    if (chip8.backend == Chip8::Backend::Block) {
+
+        for (int i = 0; i < FUSION_COUNT; i++) {
+
+            double hits = (chip8.instructionCount > 0) ? 100.0 * chip8.fusionHits[i] / chip8.instructionCount : 0;
+            printf("    %-16s %6.2f%% fused\n", FUSION_NAMES[i], hits);
+
+        }
+
+    }
+
+    printf("    state %016llx, pc=%03x\n", hashState(chip8), chip8.programCounter);
+
+    return 0;
+
+}
@@ -0,0 +1,1800 @@
+#include "chip8.h"
+#include "jit.h"
+#include <cstdio>
+#include <cstddef>
+#include <cctype>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+//Font data
+static const unsigned char font [80] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+const char * const FUSION_NAMES [FUSION_COUNT] = {
+    "ANNN DXYN", "6XNN 6YNN", "7XNN 3XNN", "7XNN 4XNN", "FX07 3X00 1NNN"
+};
+
+bool parseQuirkFlags(const char * flag, int & quirks) {
+
+    if (flag[0] != '-') return false;
+
+    for (size_t i = 1; flag[i] != '\0'; i++) {
+
+        int quirk = 0;
+
+        switch (tolower(flag[i])) {
+
+            case 'l': quirk = QUIRK_LEFT_SHIFT; break;
+            case 'r': quirk = QUIRK_RIGHT_SHIFT; break;
+            case 'o': quirk = QUIRK_OFFSET_JMP; break;
+            case 's': quirk = QUIRK_STORE; break;
+            case 'd': quirk = QUIRK_LOAD; break;
+
+        }
+
+        if (quirk == 0) {
+
+            printf("Invalid flag: %c. Option will be ignored\n", flag[i]);
+
+        }
+        else {
+
+            quirks = isupper(flag[i]) ? quirks & ~quirk : quirks | quirk;
+
+        }
+
+    }
+
+    return true;
+
+}
+
+//The Vip timing model counts in microseconds
+static const int VIP_CLOCK_RATE = 1000000;
+
+//How many times the Jit backend interprets a block before compiling it
+static const int JIT_THRESHOLD = 16;
+
+Chip8::Chip8() : rng(std::random_device()()) {
+
+    reset();
+
+}
+
+//Defined here so the unique_ptr can see the whole Chip8Jit
+Chip8::~Chip8() {
+
+}
+
+void Chip8::reset() {
+
+    std::fill_n(memory, MEMORY_SIZE, 0);
+    std::fill_n(display, DISPLAY_HEIGHT, 0);
+    std::fill_n(registers, 16, 0);
+    std::fill_n(stack, 16, 0);
+    indexRegister = 0;
+    stackIndex = 0;
+    programCounter = PROGRAM_START;
+    delayTimer = 0;
+    soundTimer = 0;
+    keys = 0;
+    running = true;
+    instructionCount = 0;
+    idleInstructions = 0;
+    cycleCount = 0;
+    cycleBalance = 0;
+    frameStarted = false;
+    frameWork = 0;
+    frameDone = 0;
+    frameProgress = 0;
+    sliceRate = 0;
+    wait = Wait::None;
+    interrupted = false;
+    std::fill_n(fusionHits, FUSION_COUNT, 0);
+    extraInstructions = 0;
+    applyQuirks();
+    dirtyRows = ALL_ROWS;
+
+    //Loading font data into memory. Convention is to start storing the font data at 0x050 (0d80)
+    for (unsigned int i = 0; i < 80; i++) {
+
+        memory[i + FONT_START] = font[i];
+
+    }
+
+}
+
+bool Chip8::loadRom(const char * path) {
+
+    reset();
+
+    std::fstream rom;
+    rom.open(path, std::ios::in | std::ios::binary | std::ios::ate);
+
+    if (!rom.is_open()) {
+
+        return false;
+
+    }
+
+    int size = rom.tellg();
+    rom.seekg(0, std::ios::beg);
+
+    //Anything that doesn't fit in program space is dropped
+    size = std::min(size, MEMORY_SIZE - PROGRAM_START);
+    rom.read((char *)(&memory[PROGRAM_START]), size);
+    rom.close();
+    flushCaches();
+
+    return true;
+
+}
+
+void Chip8::flushCaches() {
+
+    for (int i = 0; i < MEMORY_SIZE / 2; i++) {
+
+        decodeCache[i].handler = nullptr;
+
+    }
+
+    dirtyPages = ~0ULL;
+    invalidateBlocks();
+
+}
+
+void Chip8::saveState(Snapshot & snapshot) const {
+
+    snapshot.state = *this;
+    snapshot.rng = rng;
+    snapshot.running = running;
+    snapshot.dirtyRows = dirtyRows;
+    snapshot.cycleBalance = cycleBalance;
+    snapshot.frameStarted = frameStarted;
+    snapshot.frameWork = frameWork;
+    snapshot.frameDone = frameDone;
+    snapshot.frameProgress = frameProgress;
+    snapshot.sliceRate = sliceRate;
+    snapshot.instructionCount = instructionCount;
+    snapshot.idleInstructions = idleInstructions;
+    snapshot.cycleCount = cycleCount;
+    std::copy_n(fusionHits, FUSION_COUNT, snapshot.fusionHits);
+
+}
+
+void Chip8::restoreState(const Snapshot & snapshot) {
+
+    //Most of the time only a few pages of data changed, so the decoded program in every other page stays valid
+    for (int page = 0; page < PAGE_COUNT; page++) {
+
+        int start = page * PAGE_SIZE;
+
+        if (std::memcmp(memory + start, snapshot.state.memory + start, PAGE_SIZE) != 0) {
+
+            std::memcpy(memory + start, snapshot.state.memory + start, PAGE_SIZE);
+
+            for (int address = start; address < start + PAGE_SIZE; address += 2) {
+
+                decodeCache[address >> 1].handler = nullptr;
+
+            }
+
+            dirtyPages |= 1ULL << page;
+
+        }
+
+    }
+
+    //Memory is up to date now, so only the rest of the state after it is copied
+    const size_t rest = offsetof(Chip8State, display);
+    std::memcpy((unsigned char *) static_cast<Chip8State *>(this) + rest, (const unsigned char *) &snapshot.state + rest,
+        sizeof(Chip8State) - rest);
+    rng = snapshot.rng;
+    running = snapshot.running;
+    dirtyRows = snapshot.dirtyRows;
+    cycleBalance = snapshot.cycleBalance;
+    frameStarted = snapshot.frameStarted;
+    frameWork = snapshot.frameWork;
+    frameDone = snapshot.frameDone;
+    frameProgress = snapshot.frameProgress;
+    sliceRate = snapshot.sliceRate;
+    instructionCount = snapshot.instructionCount;
+    idleInstructions = snapshot.idleInstructions;
+    cycleCount = snapshot.cycleCount;
+    std::copy_n(snapshot.fusionHits, FUSION_COUNT, fusionHits);
+    wait = Wait::None;
+    interrupted = false;
+
+}
+
+void Chip8::setKeys(unsigned short keyMask) {
+
+    keys = keyMask;
+
+}
+
+void Chip8::seedRandom(unsigned int seed) {
+
+    rng.seed(seed);
+
+}
+
+void Chip8::tickTimers() {
+
+    delayTimer += (delayTimer > 0) ? -1 : 0;
+    soundTimer += (soundTimer > 0) ? -1 : 0;
+
+}
+
+void Chip8::runFrame() {
+
+    if (!frameStarted) startFrame();
+
+    runFrameWork(frameWork);
+    tickTimers();
+    frameStarted = false;
+
+}
+
+void Chip8::runFrameSlice(int hz) {
+
+    //frameProgress counts in 1/hz of a frame
+    if (hz != sliceRate) {
+
+        frameProgress = (sliceRate > 0) ? frameProgress * hz / sliceRate : 0;
+        sliceRate = hz;
+
+    }
+
+    frameProgress += 60;
+
+    while (frameProgress >= hz) {
+
+        frameProgress -= hz;
+        runFrame();
+
+    }
+
+    //Then as much of the next frame as the rest of the slice covers
+    if (frameProgress > 0) {
+
+        if (!frameStarted) startFrame();
+
+        runFrameWork(frameWork * frameProgress / hz);
+
+    }
+
+}
+
+//Roughly how long each instruction took on the COSMAC VIP in microseconds. DXYN waited for the next display interrupt so it
+//costs more than a whole frame. Instructions the VIP didn't have are charged like the cheapest one so time always moves
+static int vipCycles(unsigned short opcode) {
+
+    switch (opcode >> 12) {
+
+        case 0x0:
+            return (opcode == 0x00E0) ? 109 : (opcode == 0x00EE) ? 105 : 27;
+        case 0x1: case 0x2: case 0xB:
+            return 105;
+        case 0x3: case 0x4: case 0xA:
+            return 55;
+        case 0x5: case 0x9: case 0xE:
+            return 73;
+        case 0x6:
+            return 27;
+        case 0x7:
+            return 45;
+        case 0x8:
+            return 200;
+        case 0xC:
+            return 164;
+        case 0xD:
+            return 22734;
+        default:
+            switch (opcode & 0xFF) {
+
+                case 0x1E: return 86;
+                case 0x29: return 91;
+                case 0x33: return 927;
+                case 0x55: case 0x65: return 605;
+                default: return 45;
+
+            }
+
+    }
+
+}
+
+//Works out how much work the next frame is made of
+void Chip8::startFrame() {
+
+    frameStarted = true;
+    frameDone = 0;
+
+    switch (timing) {
+
+        case Timing::Frame:
+            frameWork = cyclesPerFrame;
+            break;
+        case Timing::Flat:
+            //Every instruction costs 60 and a frame is worth instructionsPerSecond, so run just enough to use it up
+            cycleBalance += instructionsPerSecond;
+            frameWork = (cycleBalance > 0) ? (cycleBalance + 59) / 60 : 0;
+            break;
+        case Timing::Vip:
+            cycleBalance += VIP_CLOCK_RATE;
+            frameWork = cycleBalance;
+            break;
+
+    }
+
+}
+
+//Runs the current frame until target of its work has been done. Work is instructions, except with the Vip timing model
+//where it's cycles
+void Chip8::runFrameWork(long long target) {
+
+    if (timing != Timing::Vip) {
+
+        long long n = std::max(target - frameDone, 0LL);
+
+        runCycles(n);
+        frameDone += n;
+
+        if (timing == Timing::Flat) {
+
+            cycleBalance -= n * 60;
+            cycleCount += n;
+
+        }
+
+        return;
+
+    }
+
+    //The cost depends on the instruction so they have to be run one at a time
+    while (frameDone < target && running) {
+
+        int cost = vipCycles((memory[programCounter & 0xFFF] << 8) | memory[(programCounter + 1) & 0xFFF]);
+        step();
+        frameDone += cost * 60;
+        cycleBalance -= cost * 60;
+        cycleCount += cost;
+
+    }
+
+}
+
+//Every instruction that writes to memory goes through here so stale decoded copies of the code get thrown away.
+//ROMs do modify their own code
+inline void Chip8::writeMemory(unsigned short address, unsigned char value) {
+
+    address &= 0xFFF;
+    memory[address] = value;
+    decodeCache[address >> 1].handler = nullptr;
+    dirtyPages |= 1ULL << (address / PAGE_SIZE);
+
+}
+
+//A quirk configuration fixed at compile time. Bits is a combination of the QUIRK_ flags in chip8.h
+template <int Bits>
+struct Quirks {
+
+    static const bool originalRightShift = (Bits & QUIRK_RIGHT_SHIFT) != 0;
+    static const bool originalLeftShift = (Bits & QUIRK_LEFT_SHIFT) != 0;
+    static const bool originalOffsetJmp = (Bits & QUIRK_OFFSET_JMP) != 0;
+    static const bool originalStore = (Bits & QUIRK_STORE) != 0;
+    static const bool originalLoad = (Bits & QUIRK_LOAD) != 0;
+
+};
+
+//The instruction handlers. Every backend ends up calling these so the behavior of each instruction only lives in one place.
+//When a handler runs the program counter has already been moved past the instruction.
+//Q is one of the Quirks above. Each quirk configuration gets its own copy of every handler with the quirk checks compiled
+//away, so they cost nothing at run time
+template <class Q>
+struct Chip8Ops {
+
+    //Execute machine language routine - doesn't need to be implemented
+    static void op0NNN(Chip8 &, const Instruction &) {
+
+    }
+
+    //Clear instruction - sets all pixels to off
+    static void op00E0(Chip8 & c, const Instruction & ins) {
+
+        //Only 00E0 clears the screen; 0NNN instructions that happen to end in E0 are machine language routines
+        if (ins.x != 0) return;
+
+        for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+
+            if (c.display[y]) c.dirtyRows |= 1u << y;
+
+        }
+
+        std::fill_n(c.display, DISPLAY_HEIGHT, 0);
+
+    }
+
+    //Subroutine return - this instruction is called whenever a subroutine returns. Sets the program counter to the top of
+    //the stack
+    static void op00EE(Chip8 & c, const Instruction & ins) {
+
+        if (ins.x != 0) return;
+
+        c.stackIndex--;
+        c.programCounter = c.stack[c.stackIndex & 0xF];
+
+    }
+
+    //Jump instruction - takes the form 1NNN where NNN is the address the program counter is set to
+    static void op1NNN(Chip8 & c, const Instruction & ins) {
+
+        c.programCounter = ins.nnn;
+
+    }
+
+    //Subroutine instruction - takes the form 2NNN. Calls the subroutine at memory address NNN; push the current PC onto the stack
+    //before jumping
+    static void op2NNN(Chip8 & c, const Instruction & ins) {
+
+        if (c.stackIndex > 15) {
+
+            if (!c.quiet) printf("Error: stack overflow\n");
+            c.running = false;
+            c.interrupted = true;
+
+        }
+        else {
+
+            c.stack[c.stackIndex & 0xF] = c.programCounter;
+            c.programCounter = ins.nnn;
+            c.stackIndex++;
+
+        }
+
+    }
+
+    //Conditional jump instruction - takes the form 3XNN where if the value of VX == NN then the next instruction is skipped
+    //Verified
+    static void op3XNN(Chip8 & c, const Instruction & ins) {
+
+        if (c.registers[ins.x] == ins.nn) {
+
+            c.programCounter += 2;
+
+        }
+
+    }
+
+    //Conditional jump instruction - takes the form 4XNN where if the values of VX != NN then the next instruction is skipped
+    //Verified
+    static void op4XNN(Chip8 & c, const Instruction & ins) {
+
+        if (c.registers[ins.x] != ins.nn) {
+
+            c.programCounter += 2;
+
+        }
+
+    }
+
+    //Conditional jump instruction - takes the form 5XY0 where if VX == VY then the next instruction is skipped
+    //Verified
+    static void op5XY0(Chip8 & c, const Instruction & ins) {
+
+        if (c.registers[ins.x] == c.registers[ins.y]) {
+
+            c.programCounter += 2;
+
+        }
+
+    }
+
+    //Set register instruction - takes the form 6XNN; sets the register VX to the value NN
+    //Verified
+    static void op6XNN(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = ins.nn;
+
+    }
+
+    //Add instruction - takes the form 7XNN; adds NN to the register VX
+    //Verified
+    static void op7XNN(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] += ins.nn;
+
+    }
+
+    //All 8000 instructions are arithmetic or logical - the exact instruction is determined by the lowest nibble; note that none of
+    //these instructions affect VY
+
+    //Set instruction - takes form 8XY0 and sets the value of VX to the value of VY
+    static void op8XY0(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = c.registers[ins.y];
+
+    }
+
+    //Binary OR instruction - takes form 8XY1 and sets the value of VX to VY | VX
+    //Verified
+    static void op8XY1(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = c.registers[ins.x] | c.registers[ins.y];
+
+    }
+
+    //Binary AND instruction - sets value of VX to VX & VY
+    //Verified
+    static void op8XY2(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = c.registers[ins.x] & c.registers[ins.y];
+
+    }
+
+    //Logical XOR - sets value of VX to VX XOR VY
+    //Verified
+    static void op8XY3(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = c.registers[ins.x] ^ c.registers[ins.y];
+
+    }
+
+    //Add - Sets the value of VX to VX + VY; affects carry flag
+    static void op8XY4(Chip8 & c, const Instruction & ins) {
+
+        unsigned short prev = c.registers[ins.x];
+        c.registers[ins.x] += c.registers[ins.y];
+        c.registers[0xF] = (prev > c.registers[ins.x]) ? 1 : 0;
+
+    }
+
+    //Subtract - sets the value of VX to VX - VY; VF is set to 1 if VX > VY
+    //Verified
+    static void op8XY5(Chip8 & c, const Instruction & ins) {
+
+        unsigned short prev = c.registers[ins.x];
+        c.registers[ins.x] -= c.registers[ins.y];
+        c.registers[0xF] = (prev >= c.registers[ins.y]) ? 1 : 0;
+
+    }
+
+    //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
+    //Right shift - in the original implementation, set VX = VY and shift VX right by one; set VF to the shifted bit
+    //In later implementations, shift VX in place and ignore VY
+    //Verified
+    static void op8XY6(Chip8 & c, const Instruction & ins) {
+
+        if (Q::originalRightShift) {
+
+            c.registers[ins.x] = c.registers[ins.y];
+
+        }
+        unsigned short prev = c.registers[ins.x];
+        c.registers[ins.x] = c.registers[ins.x] >> 1;
+        c.registers[0x0F] = ((prev & 1) == 1) ? 1 : 0;
+
+    }
+
+    //Subtract - sets the value of VX to VY - VX; VF is set to 1 if VX < VY
+    //Verified
+    static void op8XY7(Chip8 & c, const Instruction & ins) {
+
+        unsigned short prev = c.registers[ins.x];
+        c.registers[ins.x] = c.registers[ins.y] - c.registers[ins.x];
+        c.registers[0xF] = (prev <= c.registers[ins.y]) ? 1 : 0;
+
+    }
+
+    //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
+    //Left shift - in the original implementation, set VX = VY and shift VX left by one; set VF to the shifted bit
+    //In later implementations, shift VX in place and ignore VY
+    //Verified
+    static void op8XYE(Chip8 & c, const Instruction & ins) {
+
+        if (Q::originalLeftShift) {
+
+            c.registers[ins.x] = c.registers[ins.y];
+
+        }
+        unsigned short prev = c.registers[ins.x];
+        c.registers[ins.x] = c.registers[ins.x] << 1;
+        c.registers[0x0F] = ((prev & 128) == 128) ? 1 : 0;
+
+    }
+
+    //Conditional jump instruction - takes the form 9XY0 where if VX != VY then the next instruction is skipped
+    //Verified
+    static void op9XY0(Chip8 & c, const Instruction & ins) {
+
+        if (c.registers[ins.x] != c.registers[ins.y]) {
+
+            c.programCounter += 2;
+
+        }
+
+    }
+
+    //Set index register instruction - takes the form ANNN; sets I to NNNN;
+    //Verified
+    static void opANNN(Chip8 & c, const Instruction & ins) {
+
+        c.indexRegister = ins.nnn;
+
+    }
+
+    //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
+    //Jump with offset - Takes form DNNN in the original implementation; In the original implementation, jumps to address NNN plus
+    //the value of V0. In later implementations it takes the form DXNN and jumps to address XNN plus the value of VX
+    static void opBNNN(Chip8 & c, const Instruction & ins) {
+
+        c.programCounter = (Q::originalOffsetJmp) ? ins.nnn + c.registers[0] : ins.nnn + c.registers[ins.x];
+
+    }
+
+    //Generate random number - Takes form CXNN; generates a random number, ANDs it with NN and puts the value in VX
+    static void opCXNN(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = c.rng() & ins.nn;
+
+    }
+
+    //Display instruction - takes the form DXYN; draws an N pixel tall sprite from the memory location stored at the index register
+    //to the horizontal coordinate stored in VX and vertical coordinate stored in VY. If any pixels are turned off, then VF is set
+    //to 1 (otherwise set to 0)
+    //Verified
+    static void opDXYN(Chip8 & c, const Instruction & ins) {
+
+        unsigned int xCoord = c.registers[ins.x] & 63;
+        unsigned int yCoord = c.registers[ins.y] & 31;
+
+        c.registers[0xF] = 0;
+
+        for (unsigned int i = 0; i < ins.n; i++) {
+
+            if (yCoord + i > 31) break;
+
+            //Line the sprite row up with the display row. Pixels that fall off the right edge are shifted out (clipped)
+            uint64_t spriteRow = (uint64_t)c.memory[(c.indexRegister + i) & 0xFFF] << (DISPLAY_WIDTH - 8) >> xCoord;
+
+            //Any pixel that is already on and is on in the sprite row gets turned off, which sets VF to 1
+            if (c.display[yCoord + i] & spriteRow) {
+
+                c.registers[0xF] = 1;
+
+            }
+
+            c.display[yCoord + i] ^= spriteRow;
+
+            if (spriteRow) c.dirtyRows |= 1u << (yCoord + i);
+
+        }
+
+    }
+
+    //Skip if instructions - both instructions skip based on if a key is currently being pressed or not
+    //CHIP 8 uses a hexidecimal keypad so each code corresponds to a hex digit
+
+    //Skip if key pressed - takes form EX9E; skips the next instruction if the key corresponding to the number in VX
+    //is pressed
+    static void opEX9E(Chip8 & c, const Instruction & ins) {
+
+        if ((c.keys >> (c.registers[ins.x] & 0xF)) & 1) {
+
+            c.programCounter += 2;
+
+        }
+
+    }
+
+    //Skip if not key pressed - takes form EXA1; skips the next instruction if the key corresponding to the number in VX
+    //is not being pressed
+    static void opEXA1(Chip8 & c, const Instruction & ins) {
+
+        if (!((c.keys >> (c.registers[ins.x] & 0xF)) & 1)) {
+
+            c.programCounter += 2;
+
+        }
+
+    }
+
+    //Timers and miscellaneous instructions
+    //All of these instructions take the form FX~~; in other words, they all interpret the 3rd nibble as a register
+
+    //These first three are timer related instructions
+    //Sets VX equal to the value of the delay timer
+    static void opFX07(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = c.delayTimer;
+        c.checkDelayWait(c.programCounter - 2, ins.x);
+
+    }
+
+    //Sets the delay timer equal to value in VX
+    static void opFX15(Chip8 & c, const Instruction & ins) {
+
+        c.delayTimer = c.registers[ins.x];
+
+    }
+
+    //Sets the sound timer to the value in VX
+    static void opFX18(Chip8 & c, const Instruction & ins) {
+
+        c.soundTimer = c.registers[ins.x];
+
+    }
+
+    //Add the value in VX to I
+    //NOTE: in the original implementation this did not affect VF but this implementation will since some later
+    //implementations expect this behavior
+    static void opFX1E(Chip8 & c, const Instruction & ins) {
+
+        unsigned short prev = c.indexRegister;
+        c.indexRegister += c.registers[ins.x];
+        c.registers[0xF] = (prev > c.indexRegister) ? 1 : 0;
+
+    }
+
+    //Get key - this instruction blocks until a key is pressed (timers are still decremented regularly); once a key is
+    //pressed its hex value is put in VX
+    static void opFX0A(Chip8 & c, const Instruction & ins) {
+
+        int hxVal = 0x10;
+
+        for (int i = 0; i < 16; i++) {
+
+            if ((c.keys >> i) & 1) {
+
+                hxVal = i;
+                break;
+
+            }
+
+        }
+
+        if (hxVal != 0x10) {
+
+            c.registers[ins.x] = hxVal;
+
+        }
+        else {
+
+            //Nothing changes until a key is pressed, so the rest of the batch can be skipped
+            c.programCounter -= 2;
+            c.wait = Chip8::Wait::Key;
+            c.waitAddress = c.programCounter;
+            c.interrupted = true;
+
+        }
+
+    }
+
+    //Sets the index register to the address of the hex character in VX (meaning the character's font data); use the last
+    //nibble of VX
+    static void opFX29(Chip8 & c, const Instruction & ins) {
+
+        int hexVal = c.registers[ins.x] & 0xF;
+        c.indexRegister = FONT_START + hexVal * 5;
+
+    }
+
+    //Store each individual digit of the number in VX starting at memory[indexRegister]; in other words, store the Binary
+    //Coded Decimal value of the number
+    //Verified
+    static void opFX33(Chip8 & c, const Instruction & ins) {
+
+        unsigned char num = c.registers[ins.x];
+        c.writeMemory(c.indexRegister, num / 100);
+        c.writeMemory(c.indexRegister + 1, (num / 10) % 10);
+        c.writeMemory(c.indexRegister + 2, num % 10);
+
+    }
+
+    //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
+    //Store instruction - stores all of the data in registers V0 to VX in memory at the address in the index register.
+    //In the original implementation, this is done by incrementing the index register. In later implementations,
+    //the index register isn't affected
+    static void opFX55(Chip8 & c, const Instruction & ins) {
+
+        for (int i = 0; i <= ins.x; i++) {
+
+            c.writeMemory(c.indexRegister + i, c.registers[i]);
+
+        }
+        c.indexRegister += (Q::originalStore) ? ins.x : 0;
+
+    }
+
+    //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
+    //Load instruction - loads data into registers V0 to VX from memory at the address in index register. Like the store
+    //instruction, the original implementation incremented the index register while later implementations did not
+    static void opFX65(Chip8 & c, const Instruction & ins) {
+
+        for (int i = 0; i <= ins.x; i++) {
+
+            c.registers[i] = c.memory[(c.indexRegister + i) & 0xFFF];
+
+        }
+        c.indexRegister += (Q::originalLoad) ? ins.x : 0;
+
+    }
+
+    //Anything that isn't a valid instruction is ignored
+    static void opInvalid(Chip8 &, const Instruction &) {
+
+    }
+
+    //Superinstructions. These are only built by fuseBlock, which packs the operands of the fused instructions into a single
+    //Instruction. The program counter is past the first instruction when they run
+
+    //ANNN DXYN - nnn is the sprite address, x, y and n come from the DXYN
+    static void fuseSprite(Chip8 & c, const Instruction & ins) {
+
+        c.indexRegister = ins.nnn;
+        c.programCounter += 2;
+        opDXYN(c, ins);
+        c.fusionHits[FUSE_SPRITE] += 2;
+
+    }
+
+    //6XNN 6YNN - nn is the value for VX and nnn the value for VY
+    static void fuseSetPair(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = ins.nn;
+        c.registers[ins.y] = ins.nnn;
+        c.programCounter += 2;
+        c.fusionHits[FUSE_SET_PAIR] += 2;
+
+    }
+
+    //7XNN 3XNN - nn is the step and nnn the value compared against
+    static void fuseCountEq(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] += ins.nn;
+        c.programCounter += (c.registers[ins.x] == ins.nnn) ? 4 : 2;
+        c.fusionHits[FUSE_COUNT_EQ] += 2;
+
+    }
+
+    //7XNN 4XNN - nn is the step and nnn the value compared against
+    static void fuseCountNe(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] += ins.nn;
+        c.programCounter += (c.registers[ins.x] != ins.nnn) ? 4 : 2;
+        c.fusionHits[FUSE_COUNT_NE] += 2;
+
+    }
+
+    //FX07 3X00 1NNN - nnn is the jump target. Once the timer reaches 0 the jump is skipped
+    static void fuseDelayWait(Chip8 & c, const Instruction & ins) {
+
+        c.registers[ins.x] = c.delayTimer;
+
+        if (c.registers[ins.x] == 0) {
+
+            c.programCounter += 4;
+            c.fusionHits[FUSE_DELAY_WAIT] += 2;
+
+        }
+        else {
+
+            c.programCounter = ins.nnn;
+            c.extraInstructions++;
+            c.fusionHits[FUSE_DELAY_WAIT] += 3;
+            c.checkDelayWait(ins.nnn, ins.x);
+
+        }
+
+    }
+
+    //Executes an instruction by decoding it with nested switches. This is the portable reference path
+    static void execute(Chip8 & c, const Instruction & ins) {
+
+        switch (ins.opcode >> 12) {
+
+            case 0x0:
+                switch (ins.nnn) {
+                    case 0x0E0: op00E0(c, ins); break;
+                    case 0x0EE: op00EE(c, ins); break;
+                    default: op0NNN(c, ins); break;
+                }
+                break;
+            case 0x1: op1NNN(c, ins); break;
+            case 0x2: op2NNN(c, ins); break;
+            case 0x3: op3XNN(c, ins); break;
+            case 0x4: op4XNN(c, ins); break;
+            case 0x5: op5XY0(c, ins); break;
+            case 0x6: op6XNN(c, ins); break;
+            case 0x7: op7XNN(c, ins); break;
+            case 0x8:
+                switch (ins.n) {
+                    case 0x0: op8XY0(c, ins); break;
+                    case 0x1: op8XY1(c, ins); break;
+                    case 0x2: op8XY2(c, ins); break;
+                    case 0x3: op8XY3(c, ins); break;
+                    case 0x4: op8XY4(c, ins); break;
+                    case 0x5: op8XY5(c, ins); break;
+                    case 0x6: op8XY6(c, ins); break;
+                    case 0x7: op8XY7(c, ins); break;
+                    case 0xE: op8XYE(c, ins); break;
+                }
+                break;
+            case 0x9: op9XY0(c, ins); break;
+            case 0xA: opANNN(c, ins); break;
+            case 0xB: opBNNN(c, ins); break;
+            case 0xC: opCXNN(c, ins); break;
+            case 0xD: opDXYN(c, ins); break;
+            case 0xE:
+                switch (ins.nn) {
+                    case 0x9E: opEX9E(c, ins); break;
+                    case 0xA1: opEXA1(c, ins); break;
+                }
+                break;
+            case 0xF:
+                switch (ins.nn) {
+                    case 0x07: opFX07(c, ins); break;
+                    case 0x15: opFX15(c, ins); break;
+                    case 0x18: opFX18(c, ins); break;
+                    case 0x1E: opFX1E(c, ins); break;
+                    case 0x0A: opFX0A(c, ins); break;
+                    case 0x29: opFX29(c, ins); break;
+                    case 0x33: opFX33(c, ins); break;
+                    case 0x55: opFX55(c, ins); break;
+                    case 0x65: opFX65(c, ins); break;
+                }
+                break;
+
+        }
+
+    }
+
+    //The Switch backend's loop
+    static int runSwitch(Chip8 & c, int n) {
+
+        int i = 0;
+
+        while (i < n && !c.interrupted) {
+
+            execute(c, c.fetch());
+            i++;
+
+        }
+
+        return i;
+
+    }
+
+#if defined(__GNUC__)
+    //The Threaded backend's loop. Uses the GCC/Clang labels as values extension so that every handler ends in its own
+    //indirect jump straight to the next instruction's handler. Each of those jumps gets its own slot in the host's branch
+    //predictor, which can then learn which instruction tends to follow which
+    static int runThreaded(Chip8 & c, int n) {
+
+        //Label for every entry of the handler table, laid out the same way as handlerTables
+        static void * labels [0x1000];
+        static bool labelsBuilt = false;
+
+        if (!labelsBuilt) {
+
+            static void * const groups [16] = {
+                &&do0NNN, &&do1NNN, &&do2NNN, &&do3XNN, &&do4XNN, &&do5XY0, &&do6XNN, &&do7XNN,
+                &&doInvalid, &&do9XY0, &&doANNN, &&doBNNN, &&doCXNN, &&doDXYN, &&doInvalid, &&doInvalid
+            };
+            static void * const aluOps [16] = {
+                &&do8XY0, &&do8XY1, &&do8XY2, &&do8XY3, &&do8XY4, &&do8XY5, &&do8XY6, &&do8XY7,
+                &&doInvalid, &&doInvalid, &&doInvalid, &&doInvalid, &&doInvalid, &&doInvalid, &&do8XYE, &&doInvalid
+            };
+
+            for (int i = 0; i < 0x1000; i++) {
+
+                labels[i] = (i >> 8 == 0x8) ? aluOps[i & 0xF] : groups[i >> 8];
+
+            }
+
+            labels[0x0E0] = &&do00E0;
+            labels[0x0EE] = &&do00EE;
+            labels[0xE9E] = &&doEX9E;
+            labels[0xEA1] = &&doEXA1;
+            labels[0xF07] = &&doFX07;
+            labels[0xF15] = &&doFX15;
+            labels[0xF18] = &&doFX18;
+            labels[0xF1E] = &&doFX1E;
+            labels[0xF0A] = &&doFX0A;
+            labels[0xF29] = &&doFX29;
+            labels[0xF33] = &&doFX33;
+            labels[0xF55] = &&doFX55;
+            labels[0xF65] = &&doFX65;
+            labelsBuilt = true;
+
+        }
+
+        int i = 0;
+        Instruction ins;
+
+        #define DISPATCH() \
+            do { \
+                if (i == n) return i; \
+                i++; \
+                ins = c.fetch(); \
+                goto * labels[((ins.opcode >> 4) & 0xF00) | ins.nn]; \
+            } while (0)
+
+        if (c.interrupted) return 0;
+        DISPATCH();
+
+        do00E0:
+            op00E0(c, ins);
+            DISPATCH();
+        do00EE:
+            op00EE(c, ins);
+            DISPATCH();
+        do0NNN:
+            op0NNN(c, ins);
+            DISPATCH();
+        do1NNN:
+            op1NNN(c, ins);
+            DISPATCH();
+        do2NNN:
+            op2NNN(c, ins);
+            //Only a stack overflow or an idle loop can interrupt the loop
+            if (c.interrupted) return i;
+            DISPATCH();
+        do3XNN:
+            op3XNN(c, ins);
+            DISPATCH();
+        do4XNN:
+            op4XNN(c, ins);
+            DISPATCH();
+        do5XY0:
+            op5XY0(c, ins);
+            DISPATCH();
+        do6XNN:
+            op6XNN(c, ins);
+            DISPATCH();
+        do7XNN:
+            op7XNN(c, ins);
+            DISPATCH();
+        do8XY0:
+            op8XY0(c, ins);
+            DISPATCH();
+        do8XY1:
+            op8XY1(c, ins);
+            DISPATCH();
+        do8XY2:
+            op8XY2(c, ins);
+            DISPATCH();
+        do8XY3:
+            op8XY3(c, ins);
+            DISPATCH();
+        do8XY4:
+            op8XY4(c, ins);
+            DISPATCH();
+        do8XY5:
+            op8XY5(c, ins);
+            DISPATCH();
+        do8XY6:
+            op8XY6(c, ins);
+            DISPATCH();
+        do8XY7:
+            op8XY7(c, ins);
+            DISPATCH();
+        do8XYE:
+            op8XYE(c, ins);
+            DISPATCH();
+        do9XY0:
+            op9XY0(c, ins);
+            DISPATCH();
+        doANNN:
+            opANNN(c, ins);
+            DISPATCH();
+        doBNNN:
+            opBNNN(c, ins);
+            DISPATCH();
+        doCXNN:
+            opCXNN(c, ins);
+            DISPATCH();
+        doDXYN:
+            opDXYN(c, ins);
+            DISPATCH();
+        doEX9E:
+            opEX9E(c, ins);
+            DISPATCH();
+        doEXA1:
+            opEXA1(c, ins);
+            DISPATCH();
+        doFX07:
+            opFX07(c, ins);
+            if (c.interrupted) return i;
+            DISPATCH();
+        doFX15:
+            opFX15(c, ins);
+            DISPATCH();
+        doFX18:
+            opFX18(c, ins);
+            DISPATCH();
+        doFX1E:
+            opFX1E(c, ins);
+            DISPATCH();
+        doFX0A:
+            opFX0A(c, ins);
+            if (c.interrupted) return i;
+            DISPATCH();
+        doFX29:
+            opFX29(c, ins);
+            DISPATCH();
+        doFX33:
+            opFX33(c, ins);
+            DISPATCH();
+        doFX55:
+            opFX55(c, ins);
+            DISPATCH();
+        doFX65:
+            opFX65(c, ins);
+            DISPATCH();
+        doInvalid:
+            opInvalid(c, ins);
+            DISPATCH();
+
+        #undef DISPATCH
+
+    }
+#else
+    //Without labels as values the Threaded backend falls back to the switch
+    static int runThreaded(Chip8 & c, int n) {
+
+        return runSwitch(c, n);
+
+    }
+#endif
+
+};
+
+//Handler table indexed by the first nibble of the opcode followed by its low byte. Those 12 bits are enough to tell every
+//instruction apart (the 0x8 group only needs the last nibble, the 0x0, 0xE and 0xF groups need the whole low byte) so the
+//second level of the nested switch is flattened into the table and each instruction costs one indirect call
+//There is one table per quirk configuration
+static Chip8::Handler handlerTables [QUIRK_SET_COUNT][0x1000];
+static Chip8::Loop switchLoops [QUIRK_SET_COUNT];
+static Chip8::Loop threadedLoops [QUIRK_SET_COUNT];
+static Chip8::Handler fusionTables [QUIRK_SET_COUNT][FUSION_COUNT];
+
+template <int Bits>
+static void buildHandlerTable() {
+
+    typedef Chip8Ops<Quirks<Bits>> Ops;
+    Chip8::Handler * handlerTable = handlerTables[Bits];
+
+    std::fill_n(handlerTable, 0x1000, &Ops::opInvalid);
+
+    for (int low = 0; low < 0x100; low++) {
+
+        handlerTable[0x000 | low] = &Ops::op0NNN;
+        handlerTable[0x100 | low] = &Ops::op1NNN;
+        handlerTable[0x200 | low] = &Ops::op2NNN;
+        handlerTable[0x300 | low] = &Ops::op3XNN;
+        handlerTable[0x400 | low] = &Ops::op4XNN;
+        handlerTable[0x500 | low] = &Ops::op5XY0;
+        handlerTable[0x600 | low] = &Ops::op6XNN;
+        handlerTable[0x700 | low] = &Ops::op7XNN;
+        handlerTable[0x900 | low] = &Ops::op9XY0;
+        handlerTable[0xA00 | low] = &Ops::opANNN;
+        handlerTable[0xB00 | low] = &Ops::opBNNN;
+        handlerTable[0xC00 | low] = &Ops::opCXNN;
+        handlerTable[0xD00 | low] = &Ops::opDXYN;
+
+        static const Chip8::Handler aluOps [16] = {
+            &Ops::op8XY0, &Ops::op8XY1, &Ops::op8XY2, &Ops::op8XY3,
+            &Ops::op8XY4, &Ops::op8XY5, &Ops::op8XY6, &Ops::op8XY7,
+            &Ops::opInvalid, &Ops::opInvalid, &Ops::opInvalid, &Ops::opInvalid,
+            &Ops::opInvalid, &Ops::opInvalid, &Ops::op8XYE, &Ops::opInvalid
+        };
+        handlerTable[0x800 | low] = aluOps[low & 0xF];
+
+    }
+
+    handlerTable[0x0E0] = &Ops::op00E0;
+    handlerTable[0x0EE] = &Ops::op00EE;
+    handlerTable[0xE9E] = &Ops::opEX9E;
+    handlerTable[0xEA1] = &Ops::opEXA1;
+    handlerTable[0xF07] = &Ops::opFX07;
+    handlerTable[0xF15] = &Ops::opFX15;
+    handlerTable[0xF18] = &Ops::opFX18;
+    handlerTable[0xF1E] = &Ops::opFX1E;
+    handlerTable[0xF0A] = &Ops::opFX0A;
+    handlerTable[0xF29] = &Ops::opFX29;
+    handlerTable[0xF33] = &Ops::opFX33;
+    handlerTable[0xF55] = &Ops::opFX55;
+    handlerTable[0xF65] = &Ops::opFX65;
+
+    switchLoops[Bits] = &Ops::runSwitch;
+    threadedLoops[Bits] = &Ops::runThreaded;
+
+    Chip8::Handler * fusionTable = fusionTables[Bits];
+    fusionTable[FUSE_SPRITE] = &Ops::fuseSprite;
+    fusionTable[FUSE_SET_PAIR] = &Ops::fuseSetPair;
+    fusionTable[FUSE_COUNT_EQ] = &Ops::fuseCountEq;
+    fusionTable[FUSE_COUNT_NE] = &Ops::fuseCountNe;
+    fusionTable[FUSE_DELAY_WAIT] = &Ops::fuseDelayWait;
+
+}
+
+//Instantiates and builds the tables for every quirk configuration from Bits down to 0
+template <int Bits>
+struct HandlerTableBuilder {
+
+    HandlerTableBuilder() {
+
+        buildHandlerTable<Bits>();
+        HandlerTableBuilder<Bits - 1>();
+
+    }
+
+};
+
+template <>
+struct HandlerTableBuilder<-1> {
+
+};
+
+int Chip8::quirks() const {
+
+    return quirkSet;
+
+}
+
+void Chip8::setQuirks(int quirkFlags) {
+
+    originalRightShift = (quirkFlags & QUIRK_RIGHT_SHIFT) != 0;
+    originalLeftShift = (quirkFlags & QUIRK_LEFT_SHIFT) != 0;
+    originalOffsetJmp = (quirkFlags & QUIRK_OFFSET_JMP) != 0;
+    originalStore = (quirkFlags & QUIRK_STORE) != 0;
+    originalLoad = (quirkFlags & QUIRK_LOAD) != 0;
+
+}
+
+void Chip8::applyQuirks() {
+
+    //Built the first time a machine is configured rather than at static initialization so a Chip8 can safely be a global
+    static const HandlerTableBuilder<QUIRK_SET_COUNT - 1> handlerTablesBuilt;
+
+    quirkSet = (originalRightShift ? QUIRK_RIGHT_SHIFT : 0) | (originalLeftShift ? QUIRK_LEFT_SHIFT : 0) |
+        (originalOffsetJmp ? QUIRK_OFFSET_JMP : 0) | (originalStore ? QUIRK_STORE : 0) | (originalLoad ? QUIRK_LOAD : 0);
+    handlers = handlerTables[quirkSet];
+    switchLoop = switchLoops[quirkSet];
+    threadedLoop = threadedLoops[quirkSet];
+    fusionHandlers = fusionTables[quirkSet];
+
+    //Anything decoded so far points at the old configuration's handlers
+    flushCaches();
+
+}
+
+Instruction Chip8::decode(unsigned short opcode) const {
+
+    Instruction ins;
+    ins.handler = handlers[((opcode >> 4) & 0xF00) | (opcode & 0xFF)];
+    ins.opcode = opcode;
+    ins.nnn = opcode & 0xFFF;
+    ins.x = (opcode >> 8) & 0xF;
+    ins.y = (opcode >> 4) & 0xF;
+    ins.n = opcode & 0xF;
+    ins.nn = opcode & 0xFF;
+
+    return ins;
+
+}
+
+inline Instruction Chip8::fetch() {
+
+    //Fetch an instruction from memory
+    unsigned short opcode = (memory[programCounter & 0xFFF] << 8) | memory[(programCounter + 1) & 0xFFF];
+
+    //Increment program counter by two to prepare to fetch next instruction
+    programCounter += 2;
+
+    return decode(opcode);
+
+}
+
+//Returns the decoded instruction at the program counter, decoding it the first time an address is reached. Instructions
+//at odd addresses are decoded on the spot since the cache only covers even ones
+inline const Instruction & Chip8::fetchCached() {
+
+    unsigned short address = programCounter & 0xFFF;
+    programCounter += 2;
+
+    if (address & 1) {
+
+        oddInstruction = decode((memory[address] << 8) | memory[(address + 1) & 0xFFF]);
+        return oddInstruction;
+
+    }
+
+    Instruction & entry = decodeCache[address >> 1];
+
+    if (entry.handler == nullptr) {
+
+        entry = decode((memory[address] << 8) | memory[address + 1]);
+
+    }
+
+    return entry;
+
+}
+
+//True for instructions that can send the program counter somewhere other than the next instruction. FX0A is included
+//since it loops on itself, and FX33/FX55 since they can overwrite code later in the same block
+static bool endsBlock(unsigned short opcode) {
+
+    switch (opcode >> 12) {
+
+        case 0x0:
+            return opcode == 0x00EE;
+        case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x9: case 0xB: case 0xE:
+            return true;
+        case 0xF:
+            return (opcode & 0xFF) == 0x0A || (opcode & 0xFF) == 0x33 || (opcode & 0xFF) == 0x55;
+        default:
+            return false;
+
+    }
+
+}
+
+void Chip8::buildBlock(Block & block, unsigned short address) {
+
+    block.length = 0;
+    block.pages = 0;
+    block.hits = 0;
+    block.native = nullptr;
+
+    //Blocks stop at the end of memory rather than wrapping around
+    while (block.length < MAX_BLOCK_LENGTH && address + 1 < MEMORY_SIZE) {
+
+        unsigned short opcode = (memory[address] << 8) | memory[address + 1];
+        block.code[block.length++] = decode(opcode);
+        block.pages |= (1ULL << (address / PAGE_SIZE)) | (1ULL << ((address + 1) / PAGE_SIZE));
+        address += 2;
+
+        if (endsBlock(opcode)) break;
+
+    }
+
+    //An instruction straddling the end of memory wraps around like it does in fetch
+    if (block.length == 0) {
+
+        block.code[block.length++] = decode((memory[address] << 8) | memory[0]);
+        block.pages = (1ULL << (address / PAGE_SIZE)) | 1ULL;
+
+    }
+
+}
+
+//Builds the fused version of a block's code. address is the block's start address
+void Chip8::fuseBlock(Block & block, unsigned short address) {
+
+    block.fusedLength = 0;
+    block.span = block.length;
+
+    for (int i = 0; i < block.length;) {
+
+        const Instruction & first = block.code[i];
+        Instruction fused = first;
+        int group = first.opcode >> 12;
+        int size = 1;
+
+        if (i + 1 < block.length) {
+
+            const Instruction & second = block.code[i + 1];
+            int nextGroup = second.opcode >> 12;
+
+            if (group == 0xA && nextGroup == 0xD) {
+
+                fused = second;
+                fused.handler = fusionHandlers[FUSE_SPRITE];
+                fused.nnn = first.nnn;
+                size = 2;
+
+            }
+            else if (group == 0x6 && nextGroup == 0x6) {
+
+                fused.handler = fusionHandlers[FUSE_SET_PAIR];
+                fused.y = second.x;
+                fused.nnn = second.nn;
+                size = 2;
+
+            }
+            else if (group == 0x7 && (nextGroup == 0x3 || nextGroup == 0x4) && first.x == second.x) {
+
+                fused.handler = fusionHandlers[(nextGroup == 0x3) ? FUSE_COUNT_EQ : FUSE_COUNT_NE];
+                fused.nnn = second.nn;
+                size = 2;
+
+            }
+            //The skip ends the block, so the jump it guards is read straight from memory
+            else if (group == 0xF && first.nn == 0x07 && second.opcode == (0x3000 | (first.x << 8)) && i + 2 == block.length) {
+
+                unsigned short jumpAddress = address + 2 * (i + 2);
+
+                if (jumpAddress + 1 < MEMORY_SIZE && memory[jumpAddress] >> 4 == 0x1) {
+
+                    fused.handler = fusionHandlers[FUSE_DELAY_WAIT];
+                    fused.nnn = ((memory[jumpAddress] & 0xF) << 8) | memory[jumpAddress + 1];
+                    block.pages |= (1ULL << (jumpAddress / PAGE_SIZE)) | (1ULL << ((jumpAddress + 1) / PAGE_SIZE));
+                    block.span++;
+                    size = 2;
+
+                }
+
+            }
+
+        }
+
+        block.fused[block.fusedLength++] = fused;
+        i += size;
+
+    }
+
+}
+
+inline Chip8::Block & Chip8::lookupBlock(unsigned short address) {
+
+    std::unique_ptr<Block> & block = blockCache[address];
+
+    if (!block) {
+
+        block.reset(new Block());
+        block->length = 0;
+
+    }
+
+    if (block->length == 0) {
+
+        buildBlock(*block, address);
+        fuseBlock(*block, address);
+        liveBlocks.push_back(address);
+
+    }
+
+    return *block;
+
+}
+
+//Throws away every block whose code lives in a page that has been written to
+void Chip8::invalidateBlocks() {
+
+    for (size_t i = 0; i < liveBlocks.size();) {
+
+        Block & block = *blockCache[liveBlocks[i]];
+
+        if (block.pages & dirtyPages) {
+
+            block.length = 0;
+            liveBlocks[i] = liveBlocks.back();
+            liveBlocks.pop_back();
+
+        }
+        else {
+
+            i++;
+
+        }
+
+    }
+
+    dirtyPages = 0;
+
+}
+
+int Chip8::runJit(int n) {
+
+    if (!jit) jit.reset(new Chip8Jit());
+
+    int i = 0;
+
+    while (i < n && !interrupted) {
+
+        if (dirtyPages) invalidateBlocks();
+
+        Block & block = lookupBlock(programCounter & 0xFFF);
+
+        //Compiled blocks always run to the end so they're only used when the whole block fits in what's left of n. They
+        //also assume the program counter is a plain 12 bit address, which it is unless the program ran off the end of memory
+        if (block.length <= n - i && programCounter < MEMORY_SIZE) {
+
+            if (block.native == nullptr && block.hits >= 0 && ++block.hits >= JIT_THRESHOLD) {
+
+                //When the code buffer fills up everything is thrown away and hot blocks get compiled again
+                if (jit->full() && jit->available()) {
+
+                    jit->clear();
+                    for (unsigned short address : liveBlocks) {
+
+                        blockCache[address]->native = nullptr;
+                        blockCache[address]->hits = 0;
+
+                    }
+
+                }
+
+                block.native = jit->compile(*this, block.code, block.length, programCounter & 0xFFF);
+                if (block.native == nullptr) block.hits = -1;
+
+            }
+
+            if (block.native != nullptr) {
+
+                block.native(this, this);
+                i += block.length;
+                continue;
+
+            }
+
+        }
+
+        int length = std::min(block.length, n - i);
+
+        for (const Instruction * ins = block.code, * end = block.code + length; ins != end; ins++) {
+
+            programCounter += 2;
+            ins->handler(*this, *ins);
+
+        }
+
+        i += length;
+
+    }
+
+    return i;
+
+}
+
+void Chip8::step() {
+
+    instructionCount++;
+
+    //Single steps don't benefit from blocks so the Block backend uses the instruction cache here
+    if (backend == Backend::Cached || backend == Backend::Block || backend == Backend::Jit || backend == Backend::Compiled) {
+
+        const Instruction & ins = fetchCached();
+        ins.handler(*this, ins);
+
+    }
+    else if (backend == Backend::Table) {
+
+        Instruction ins = fetch();
+        ins.handler(*this, ins);
+
+    }
+    else if (backend == Backend::Threaded) {
+
+        threadedLoop(*this, 1);
+
+    }
+    else {
+
+        switchLoop(*this, 1);
+
+    }
+
+    //There's nothing left in the batch to skip
+    interrupted = false;
+
+}
+
+//Set by the generated file aot.cpp writes, if one is linked in
+static Chip8::CompiledRom compiledRom = nullptr;
+
+bool Chip8::registerCompiledRom(CompiledRom rom) {
+
+    compiledRom = rom;
+    return true;
+
+}
+
+bool Chip8::hasCompiledRom() {
+
+    return compiledRom != nullptr;
+
+}
+
+void Chip8::runCycles(int n) {
+
+    if (backend == Backend::Compiled && compiledRom != nullptr) {
+
+        compiledRom(*this, n);
+        return;
+
+    }
+
+    runInterpreted(n);
+
+}
+
+void Chip8::runInterpreted(int n) {
+
+    instructionCount += n;
+
+    int done = 0;
+
+    while (done < n && running) {
+
+        done += runBackend(n - done);
+
+        //The program is stuck in a loop that can't get anywhere before the batch ends, so jump straight to the end of it
+        if (interrupted) {
+
+            interrupted = false;
+
+            if (running && idle()) {
+
+                idleInstructions += n - done;
+                skipIdle(n - done);
+                done = n;
+
+            }
+
+        }
+
+    }
+
+}
+
+int Chip8::runBackend(int n) {
+
+    int i = 0;
+
+    //The backend is picked once per batch rather than once per instruction
+    switch (backend) {
+
+        case Backend::Jit:
+            i = runJit(n);
+            break;
+        case Backend::Block:
+            while (i < n && !interrupted) {
+
+                if (dirtyPages) invalidateBlocks();
+
+                Block & block = lookupBlock(programCounter & 0xFFF);
+
+                //No per-instruction checks inside a block. Anything that interrupts the loop (a stack overflow, FX0A or a
+                //delay timer wait) ends the block or is checked again once the block is done
+                if (block.span <= n - i) {
+
+                    for (const Instruction * ins = block.fused, * end = block.fused + block.fusedLength; ins != end; ins++) {
+
+                        programCounter += 2;
+                        ins->handler(*this, *ins);
+
+                    }
+
+                    i += block.length + extraInstructions;
+                    extraInstructions = 0;
+
+                }
+                //Not enough of n left for the whole block, so run the unfused code up to the limit
+                else {
+
+                    int length = std::min(block.length, n - i);
+
+                    for (const Instruction * ins = block.code, * end = block.code + length; ins != end; ins++) {
+
+                        programCounter += 2;
+                        ins->handler(*this, *ins);
+
+                    }
+
+                    i += length;
+
+                }
+
+            }
+            break;
+        //The compiled ROM only gets here through runInterpreted
+        case Backend::Cached: case Backend::Compiled:
+            while (i < n && !interrupted) {
+
+                const Instruction & ins = fetchCached();
+                ins.handler(*this, ins);
+                i++;
+
+            }
+            break;
+        case Backend::Table:
+            while (i < n && !interrupted) {
+
+                Instruction ins = fetch();
+                ins.handler(*this, ins);
+                i++;
+
+            }
+            break;
+        case Backend::Threaded:
+            i = threadedLoop(*this, n);
+            break;
+        case Backend::Switch:
+            i = switchLoop(*this, n);
+            break;
+
+    }
+
+    return i;
+
+}
+
+//Checks if the code at address is a FX07 3X00 1NNN loop that jumps back to itself
+bool Chip8::isDelayLoop(unsigned short address, unsigned char x) const {
+
+    if (address + 5 >= MEMORY_SIZE) return false;
+
+    return memory[address] == (0xF0 | x) && memory[address + 1] == 0x07 &&
+        memory[address + 2] == (0x30 | x) && memory[address + 3] == 0x00 &&
+        memory[address + 4] == (0x10 | (address >> 8)) && memory[address + 5] == (address & 0xFF);
+
+}
+
+//Called after VX was loaded from the delay timer by the instruction at address. If that instruction is the head of a
+//delay timer wait loop and the timer hasn't run out, nothing can change until the timer is decremented
+void Chip8::checkDelayWait(unsigned short address, unsigned char x) {
+
+    if (delayTimer > 0 && isDelayLoop(address, x)) {
+
+        wait = Wait::DelayTimer;
+        waitAddress = address;
+        waitRegister = x;
+        interrupted = true;
+
+    }
+
+}
+
+bool Chip8::idle() const {
+
+    switch (wait) {
+
+        case Wait::DelayTimer:
+            return delayTimer > 0 && registers[waitRegister] == delayTimer && programCounter >= waitAddress &&
+                programCounter <= waitAddress + 4 && ((programCounter - waitAddress) & 1) == 0 &&
+                isDelayLoop(waitAddress, waitRegister);
+        case Wait::Key:
+            return programCounter == waitAddress && keys == 0 && (memory[waitAddress] >> 4) == 0xF &&
+                memory[(waitAddress + 1) & 0xFFF] == 0x0A;
+        default:
+            return false;
+
+    }
+
+}
+
+//Leaves the machine exactly where it would be after running n more instructions of the idle loop
+void Chip8::skipIdle(int n) {
+
+    if (wait == Wait::DelayTimer) {
+
+        //The loop is three instructions long and only ever sets VX to the (unchanging) delay timer
+        int position = ((programCounter - waitAddress) / 2 + n) % 3;
+        programCounter = waitAddress + 2 * position;
+        registers[waitRegister] = delayTimer;
+
+    }
+
+}
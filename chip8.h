@@ -0,0 +1,331 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <cstdint>
+#include <random>
+#include <memory>
+#include <vector>
+
+//The CHIP-8 core. Nothing in here depends on SDL so it can be driven headlessly (benchmarks, tests, batch runs) as well
+//as from the SDL frontend in emu.cpp
+
+//Size of the CHIP-8 display in pixels
+const int DISPLAY_WIDTH = 64, DISPLAY_HEIGHT = 32;
+//Dirty row masks have bit N set for display row N. This is every row
+const uint32_t ALL_ROWS = 0xFFFFFFFF;
+//RAM - 4096 bytes or 4 kB. Program space starts at address 0x200 and the font data is stored at 0x050 (0d80)
+const int MEMORY_SIZE = 4096, PROGRAM_START = 0x200, FONT_START = 0x050;
+//Memory is split into 64 byte pages for tracking which parts of the program have been written to
+const int PAGE_SIZE = 64, PAGE_COUNT = MEMORY_SIZE / PAGE_SIZE;
+//Quirk flags. A quirk set is a combination of these and selects the original implementation of each instruction
+const int QUIRK_RIGHT_SHIFT = 1, QUIRK_LEFT_SHIFT = 2, QUIRK_OFFSET_JMP = 4, QUIRK_STORE = 8, QUIRK_LOAD = 16;
+//Number of possible quirk sets
+const int QUIRK_SET_COUNT = 32;
+
+//Applies a command line group of quirk letters such as "-lrosd" to quirks, a combination of the QUIRK_ flags. l, r, o, s
+//and d pick the original implementation of 8XYE, 8XY6, BNNN, FX55 and FX65. Upper case picks the modern one instead.
+//Letters that aren't quirks are reported and skipped. Returns false, leaving quirks alone, if flag doesn't start with '-'
+bool parseQuirkFlags(const char * flag, int & quirks);
+//Longest run of instructions the Block backend will put in one block
+const int MAX_BLOCK_LENGTH = 32;
+
+//Common instruction sequences the Block backend fuses into a single superinstruction
+enum Fusion {
+    FUSE_SPRITE,        //ANNN DXYN - point I at a sprite and draw it
+    FUSE_SET_PAIR,      //6XNN 6YNN - set up two registers
+    FUSE_COUNT_EQ,      //7XNN 3XNN - step a counter and skip when it hits a value
+    FUSE_COUNT_NE,      //7XNN 4XNN - step a counter and skip until it hits a value
+    FUSE_DELAY_WAIT,    //FX07 3X00 1NNN - poll the delay timer until it reaches 0
+    FUSION_COUNT
+};
+
+//Printable names of the fusions, indexed by Fusion
+extern const char * const FUSION_NAMES [FUSION_COUNT];
+
+//Everything that makes up the state of the machine. This is a plain struct so the whole machine can be copied around
+struct Chip8State {
+
+    //Kept first: Chip8::restoreState copies memory page by page and everything after it in one go
+    unsigned char memory [MEMORY_SIZE];
+    //64x32 pixel display which can be either black or white. Each row is packed into one word with the leftmost pixel in the
+    //top bit, so a sprite row can be drawn with a shift, an AND (for VF) and an XOR
+    uint64_t display [DISPLAY_HEIGHT];
+    //16 8 bit registers. Registers are labled V0 to VF. Note: VF is a special register that is used as a flag register
+    unsigned char registers [16];
+    //Points to locations in memory - 16 bits/2 bytes
+    //Also called I
+    unsigned short indexRegister;
+    //Used for calling functions/subroutines
+    unsigned short stack [16];
+    short stackIndex;
+    //The program counter. Keeps track of which instruction should be fetched from memory. Program memory starts at 0x200
+    unsigned short programCounter;
+    //Decremented at a rate of 60 Hz until it reaches 0
+    unsigned char delayTimer;
+    //Like the delay timer but it makes a sound when it's not 0
+    unsigned char soundTimer;
+    //The hex keypad. Bit N is set while the key for hex digit N is held down
+    unsigned short keys;
+
+    //True if the pixel at x, y is on
+    bool pixel(int x, int y) const {
+
+        return (display[y] >> (DISPLAY_WIDTH - 1 - x)) & 1;
+
+    }
+
+};
+
+class Chip8;
+class Chip8Jit;
+
+//A decoded instruction. The operands are pulled out of the opcode once so the handlers don't have to do it themselves
+struct Instruction {
+
+    void (*handler)(Chip8 &, const Instruction &);
+    unsigned short opcode;
+    unsigned short nnn;
+    unsigned char x, y, n, nn;
+
+};
+
+//A block compiled to native code by the JIT. It takes the machine twice: once as the state the code reads and writes
+//directly and once as the Chip8 the interpreter handlers are called with
+typedef void (*JitCode)(Chip8State * state, Chip8 * machine);
+
+class Chip8 : public Chip8State {
+
+    public:
+        typedef void (*Handler)(Chip8 &, const Instruction &);
+        //Runs up to n instructions and returns how many actually ran
+        typedef int (*Loop)(Chip8 &, int);
+        //A ROM compiled to C++ by aot.cpp. Does the same as runCycles(n)
+        typedef void (*CompiledRom)(Chip8 &, int);
+
+        //How instructions get dispatched to their handlers
+        //Switch - nested switch on the opcode nibbles. Portable reference implementation
+        //Table - one indirect call through a precomputed handler table
+        //Cached - like Table but every address is only decoded once; see decodeCache
+        //Block - runs whole straight-line blocks of cached instructions at a time; see blockCache
+        //Jit - like Block but blocks that run often are compiled to native x86-64 code; see jit.h. Only used when asked
+        //for, as most blocks are short and call back into the interpreter, so it isn't reliably faster than Block
+        //Threaded - direct threaded loop using computed gotos (GCC/Clang only, otherwise the same as Switch)
+        //Compiled - runs the ROM compiled ahead of time by aot.cpp, if a generated file is linked in (see
+        //registerCompiledRom). Single steps, the Vip timing model and anything the compiled code hands back run like Cached
+        enum class Backend { Switch, Table, Cached, Block, Jit, Threaded, Compiled };
+
+        Backend backend = Backend::Cached;
+
+        //How runFrame decides how much to run before the timers tick
+        //Frame - exactly cyclesPerFrame instructions per frame
+        //Flat - every instruction costs the same and instructionsPerSecond of them make a second. The fraction of an
+        //instruction left over at the end of a frame is carried into the next one instead of being dropped
+        //Vip - every instruction costs roughly what it took on the COSMAC VIP, in microseconds
+        //With Flat and Vip the 60 Hz timer ticks fall out of the cycle count, so a run only depends on the ROM, the quirks,
+        //the key presses on each frame and the random seed, not on how fast the host runs it
+        enum class Timing { Frame, Flat, Vip };
+
+        //Everything needed to put the machine back exactly where it was: the machine state plus the parts of the core that
+        //decide what happens next (random numbers, timing model progress). The statistics are saved too, so frames that are
+        //run and then thrown away (run-ahead) don't count towards them
+        struct Snapshot {
+
+            Chip8State state;
+            std::mt19937 rng;
+            bool running;
+            uint32_t dirtyRows;
+            long long cycleBalance;
+            bool frameStarted;
+            long long frameWork;
+            long long frameDone;
+            int frameProgress;
+            int sliceRate;
+            unsigned long long instructionCount;
+            unsigned long long idleInstructions;
+            unsigned long long cycleCount;
+            unsigned long long fusionHits [FUSION_COUNT];
+
+        };
+
+        Timing timing = Timing::Frame;
+        //Used for configuration purposes. Set to true to use the original implementation of the associated instruction.
+        //These are only read by applyQuirks(), which reset() and loadRom() call
+        bool originalRightShift = false;
+        bool originalLeftShift = false;
+        bool originalOffsetJmp = false;
+        bool originalStore = false;
+        bool originalLoad = false;
+        //How many instructions runFrame executes before decrementing the timers with the Frame timing model. The default of
+        //700 / 60 rounds down to 11, which is 660 instructions per second. Flat timing runs exactly instructionsPerSecond
+        int cyclesPerFrame = 700 / 60;
+        //Instruction rate for the Flat timing model
+        int instructionsPerSecond = 700;
+        //Cleared if the program hits an unrecoverable error such as a stack overflow
+        bool running;
+        //Set to keep the core from printing errors like a stack overflow, e.g. while running frames that will be thrown away
+        bool quiet = false;
+        //Rows of the display that DXYN or 00E0 changed. The frontend clears it once it has drawn the new frame
+        uint32_t dirtyRows;
+        //Number of instructions executed since the last reset
+        unsigned long long instructionCount;
+        //How many of those were skipped over because the program was waiting on the delay timer or a key
+        unsigned long long idleInstructions;
+        //Cycles charged by the Flat and Vip timing models since the last reset
+        unsigned long long cycleCount;
+        //How many instructions were executed as part of each kind of superinstruction since the last reset
+        unsigned long long fusionHits [FUSION_COUNT];
+
+        Chip8();
+        ~Chip8();
+        //Clears memory, registers, the stack, the timers and the display and reloads the font data
+        void reset();
+        //Resets the machine and loads the ROM at path into program space. Returns false if the file can't be read
+        bool loadRom(const char * path);
+        //Fetches, decodes and executes a single instruction
+        void step();
+        //Executes n instructions without touching the timers. The Block backend only checks the count between blocks but still
+        //stops after exactly n instructions. If the program ends up waiting on the delay timer (a FX07 3X00 1NNN loop) or on a
+        //key (FX0A) the rest of the n instructions are skipped, leaving the machine exactly as running them would have
+        void runCycles(int n);
+        //runCycles without the compiled ROM. What the compiled code falls back on for anything it can't run itself
+        void runInterpreted(int n);
+        //Executes one 60 Hz frame worth of instructions, as decided by timing, and then decrements the timers once. If the
+        //frame was already started by runFrameSlice only the rest of it is run
+        void runFrame();
+        //Executes 1/hz of a second: the same instructions and timer ticks runFrame would, just cut into hz slices a second
+        //instead of 60. For frontends that run once per display refresh
+        void runFrameSlice(int hz);
+        //Decrements the delay and sound timers if they aren't 0
+        void tickTimers();
+        //Switches the interpreter over to the copy specialized for the current quirk flags
+        void applyQuirks();
+        //The quirk set currently in use as a combination of the QUIRK_ flags
+        int quirks() const;
+        //Sets the original* flags from a combination of the QUIRK_ flags. Like the flags themselves, this takes effect on
+        //the next applyQuirks()
+        void setQuirks(int quirkFlags);
+        //Throws away every cached decoding of the program. Call this after writing to memory from outside the core
+        void flushCaches();
+        //Copies the whole machine into snapshot
+        void saveState(Snapshot & snapshot) const;
+        //Puts the machine back the way it was when snapshot was saved. Only code in the pages of memory that differ from the
+        //snapshot has to be decoded again
+        void restoreState(const Snapshot & snapshot);
+        //True while the program is spinning in a loop that can't get anywhere until the next timer tick or key press
+        bool idle() const;
+        //Updates the keypad state. Bit N is the key for hex digit N
+        void setKeys(unsigned short keyMask);
+        //Reseeds the random number generator used by CXNN so runs can be reproduced
+        void seedRandom(unsigned int seed);
+
+        //Turns an opcode into an Instruction with its handler and operands filled in
+        Instruction decode(unsigned short opcode) const;
+
+        //Makes rom what the Compiled backend runs. The file aot.cpp generates calls this from a static initializer, so
+        //linking it in is all it takes. Returns true so it can be used to initialize a static
+        static bool registerCompiledRom(CompiledRom rom);
+        //True if a compiled ROM was linked in
+        static bool hasCompiledRom();
+
+    private:
+        template <class Q> friend struct Chip8Ops;
+
+        //Set by applyQuirks()
+        int quirkSet;
+        //Handler table for the current quirk set
+        const Handler * handlers;
+        //The Switch backend's loop for the current quirk set
+        Loop switchLoop;
+        //The Threaded backend's loop for the current quirk set
+        Loop threadedLoop;
+
+        //What the program is waiting on when it sits in an idle loop
+        enum class Wait { None, DelayTimer, Key };
+
+        Wait wait;
+        //Address of the FX0A or the first instruction of the delay timer loop
+        unsigned short waitAddress;
+        //The register the delay timer loop reads the timer into
+        unsigned char waitRegister;
+        //Set by instructions that need the backend loop to stop early: a stack overflow or the start of an idle loop
+        bool interrupted;
+
+        std::mt19937 rng;
+
+        //Lazily filled table of decoded instructions, one per even address. An entry with no handler hasn't been decoded yet
+        //(or was overwritten since)
+        Instruction decodeCache [MEMORY_SIZE / 2];
+        //Scratch space for instructions at odd addresses, which the cache doesn't cover
+        Instruction oddInstruction;
+
+        //A straight-line run of instructions that ends at the first jump, call, return or skip
+        struct Block {
+
+            //Bit N is set if any of the block's code lives in page N
+            unsigned long long pages;
+            //Number of instructions in the block. 0 means the block needs to be (re)built
+            int length;
+            //How many times the Jit backend has interpreted the block. -1 if it can't be compiled
+            int hits;
+            //The compiled block, if it has been compiled
+            JitCode native;
+            Instruction code [MAX_BLOCK_LENGTH];
+            //The same code with common sequences fused into superinstructions. Fused instructions move the program counter
+            //past the instructions they swallowed themselves
+            int fusedLength;
+            Instruction fused [MAX_BLOCK_LENGTH];
+            //Most instructions running the fused code can execute. This is one more than length when the block ends in a
+            //delay timer wait, since that fusion also covers the jump that follows the block
+            int span;
+
+        };
+
+        //Blocks keyed by their start address. They are allocated the first time an address starts a block and reused after
+        //being invalidated
+        std::unique_ptr<Block> blockCache [MEMORY_SIZE];
+        //Start addresses of every block that currently holds code, so invalidation doesn't have to walk the whole cache
+        std::vector<unsigned short> liveBlocks;
+        //Bit N is set when page N was written to since blocks were last checked
+        unsigned long long dirtyPages;
+
+        //Created the first time the Jit backend runs
+        std::unique_ptr<Chip8Jit> jit;
+
+        Block & lookupBlock(unsigned short address);
+        //Instructions a superinstruction executed beyond what its block accounts for; see Block::span
+        int extraInstructions;
+        //Fusion handlers for the current quirk set, indexed by Fusion
+        const Handler * fusionHandlers;
+
+        void buildBlock(Block & block, unsigned short address);
+        void fuseBlock(Block & block, unsigned short address);
+        void invalidateBlocks();
+        int runBackend(int n);
+        int runJit(int n);
+        bool isDelayLoop(unsigned short address, unsigned char x) const;
+        void checkDelayWait(unsigned short address, unsigned char x);
+        void skipIdle(int n);
+
+        //Cycles (scaled by 60 so a frame is a whole number of them) still to run in the current frame. It goes negative when
+        //the last instruction of a frame runs over, and the next frame gets that much less
+        long long cycleBalance;
+
+        //The frame runFrame or runFrameSlice is part way through. frameWork is how much work (see runFrameWork) makes up the
+        //frame and frameDone how much of it has been done
+        bool frameStarted;
+        long long frameWork;
+        long long frameDone;
+        //How far runFrameSlice is into the current frame in 1/sliceRate of a frame
+        int frameProgress;
+        int sliceRate;
+
+        void startFrame();
+        void runFrameWork(long long target);
+
+        Instruction fetch();
+        const Instruction & fetchCached();
+        void writeMemory(unsigned short address, unsigned char value);
+
+};
+
+#endif
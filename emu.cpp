@@ -1,23 +1,44 @@
 #include <iostream>
 #include "./SDL2/include/SDL.h"
-#include <fstream>
-#include <random>
+#include "chip8.h"
+#include "pacer.h"
+#include "triplebuffer.h"
+#include "screen.h"
+#include <string>
 #include <atomic>
 #include <math.h>
 #include <chrono>
+#include <thread>
 #include <unordered_map>
-#include <stack>
+#include <algorithm>
+#include <memory>
 
 #undef main
 
-//These constants are used to set the size of the SDL window
-const int SCREEN_WIDTH = 640, SCREEN_HEIGHT = 320, LOGICAL_WIDTH = 64, LOGICAL_HEIGHT = 32;
+//The SDL window is sized to the whole multiple of the display closest to this
+const int SCREEN_WIDTH = 640, SCREEN_HEIGHT = 320;
 //These constants are used for tone generation
 const int BUFFER_DURATION = 4, FREQUENCY = 50000, BUFFER_LEN = (FREQUENCY * BUFFER_DURATION);
+//The emulator runs one batch of instructions per 60 Hz frame
+const std::chrono::nanoseconds FRAME_DURATION(1000000000 / 60);
+//Key that toggles turbo mode
+const SDL_Scancode TURBO_KEY = SDL_SCANCODE_TAB;
+//Key that prints the frame pacing report
+const SDL_Scancode REPORT_KEY = SDL_SCANCODE_F1;
 int buffer[BUFFER_LEN];
 
 std::atomic<int> bufferPos = 0;
 
+//Audio sync mode. The main loop queues whether the sound timer was on for each frame it runs, and the audio callback plays
+//those back at exactly one frame per 1/60 s worth of samples. The main loop only runs a frame when the queue has room, so
+//the audio device's clock decides how fast the emulator runs and the two can't drift apart
+const int SOUND_QUEUE_SIZE = 64, AUDIO_FRAMES_AHEAD = 4, AUDIO_SYNC_SAMPLES = 1024;
+bool soundQueue [SOUND_QUEUE_SIZE];
+//soundHead is only written by the main loop and soundTail only by the audio callback
+std::atomic<unsigned int> soundHead = 0, soundTail = 0;
+//Frames the callback wanted before the main loop had queued them
+std::atomic<unsigned long long> audioUnderruns = 0;
+
 //Functions used for tone generation
 int format(double sample, double amplitude) {
     return (int)(sample * 32567 * amplitude);
@@ -28,131 +49,536 @@ double tone(double hz, unsigned long time) {
 }
 
 void playBuffer(void *userData, unsigned char *stream, int len);
+void playSynced(void *userData, unsigned char *stream, int len);
 
-//TODO add command line args to take the name of ROM files to be loaded
-int main(int argc, char *argv []) {
-    //printf("Test test");
-    //RAM - 4096 bytes or 4 kB
-    //Program space starts at address 200
-    char * memory = new char[4096];
-    std::fill_n(memory, 4096, 0);
-    //64x32 pixel display which can be either black or white; this is used to track which pixels are on or off easily
-    bool display [64][32];
-    for (int i = 0; i < 64; i++) {
+//Number of frames queued for the audio callback that it hasn't started playing yet
+unsigned int queuedSoundFrames() {
+
+    return soundHead.load(std::memory_order_relaxed) - soundTail.load(std::memory_order_acquire);
+
+}
+
+//Queues the sound state of the frame that just ran
+void queueSound(bool on) {
+
+    unsigned int head = soundHead.load(std::memory_order_relaxed);
+
+    if (queuedSoundFrames() < SOUND_QUEUE_SIZE) {
+
+        soundQueue[head % SOUND_QUEUE_SIZE] = on;
+        soundHead.store(head + 1, std::memory_order_release);
+
+    }
+
+}
+
+//Maps hex digits to the SDL2 scancodes they correspond to
+const int hexToScan [16] = {
+    SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
+    SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
+    SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
+    SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
+};
+
+//Packs the state of the 16 CHIP-8 keys into a bitmask the core understands
+unsigned short readKeys(const Uint8 * keyState) {
 
-        for (int j = 0; j < 32; j++) {
+    unsigned short keys = 0;
 
-            display[i][j] = false;
+    for (int i = 0; i < 16; i++) {
+
+        if (keyState[hexToScan[i]] == 1) {
+
+            keys |= 1 << i;
 
         }
 
     }
-    //Points to locations in memory - 16 bits/2 bytes
-    //Also called I
-    unsigned short indexRegister;
-    //Used for calling functions/subroutines
-    unsigned short stack [16];
-    std::fill_n(stack, 16, 0);
-    short stackIndex = 0;
-    //The program counter. Keeps track of which instruction should be fetched from memory. Program memory starts at 0x200
-    unsigned short programCounter = 0x200;
-    //Decremented at a rate of 60 Hz until it reaches 0
-    unsigned char delayTimer = 0;
-    //Like the delay timer but it makes a sound when it's not 0
-    unsigned char soundTimer = 0;
-    double clockSpeed = 1000 / 700;
-    double timerSpeed = 1000 / 60;
+
+    return keys;
+
+}
+
+//A finished frame handed from the emulation thread to the main thread in --thread mode
+struct Frame {
+
+    uint64_t rows [DISPLAY_HEIGHT];
+
+};
+
+//Everything the main thread and the emulation thread share in --thread mode
+struct SharedState {
+
+    //Set by either side to stop both
+    std::atomic<bool> quit {false};
+    //Inputs from the main thread
+    std::atomic<unsigned short> keys {0};
+    std::atomic<bool> turbo {false};
+    std::atomic<bool> reportRequested {false};
+    //Set while the window is in the background under the Pause policy
+    std::atomic<bool> paused {false};
+    //Cleared while the window can't be seen and nothing is being drawn, so the emulation thread can sleep instead of spin
+    std::atomic<bool> presenting {true};
+    //Outputs from the emulation thread
+    std::atomic<bool> soundOn {false};
+    std::atomic<unsigned long long> frames {0};
+    TripleBuffer<Frame> display;
+
+};
+
+//What to do while the window is in the background
+//Run - carry on as normal
+//Throttle - keep emulating (so sound and timers carry on) but don't draw while the window can't be seen
+//Pause - stop emulating and sleep until the window is visible and focused again
+enum class Background { Run, Throttle, Pause };
+
+//Whether the window can be seen and has focus. Kept up to date by pollInput
+struct WindowState {
+
+    bool visible = true;
+    bool focused = true;
+    //Set when what was presented got lost (the window was uncovered or resized, the renderer was reset) and has to be drawn
+    //again. Cleared by the main loop
+    bool repaint = false;
+
+};
+
+//What one pump of the SDL event queue produced. Events are only pumped once per frame, at the start of it, and the keys
+//are sampled right after so the core sees one consistent 16-bit snapshot for the whole frame
+struct Input {
+
+    unsigned short keys;
+    bool quit;
+    bool toggleTurbo;
+    bool report;
+
+};
+
+Input pollInput(const Uint8 * keyState, WindowState & window) {
+
+    Input input = {0, false, false, false};
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+
+        switch(event.type) {
+
+            case SDL_QUIT:
+                input.quit = true;
+                break;
+            case SDL_KEYDOWN:
+                if (event.key.keysym.scancode == TURBO_KEY && event.key.repeat == 0) {
+
+                    input.toggleTurbo = !input.toggleTurbo;
+
+                }
+                else if (event.key.keysym.scancode == REPORT_KEY) {
+
+                    input.report = true;
+
+                }
+                break;
+            case SDL_RENDER_TARGETS_RESET: case SDL_RENDER_DEVICE_RESET:
+                window.repaint = true;
+                break;
+            case SDL_WINDOWEVENT:
+                switch (event.window.event) {
+
+                    case SDL_WINDOWEVENT_HIDDEN: case SDL_WINDOWEVENT_MINIMIZED:
+                        window.visible = false;
+                        break;
+                    case SDL_WINDOWEVENT_SHOWN: case SDL_WINDOWEVENT_RESTORED: case SDL_WINDOWEVENT_EXPOSED:
+                        window.visible = true;
+                        window.repaint = true;
+                        break;
+                    case SDL_WINDOWEVENT_SIZE_CHANGED:
+                        window.repaint = true;
+                        break;
+                    case SDL_WINDOWEVENT_FOCUS_LOST:
+                        window.focused = false;
+                        break;
+                    case SDL_WINDOWEVENT_FOCUS_GAINED:
+                        window.focused = true;
+                        break;
+
+                }
+                break;
+
+        }
+
+    }
+
+    //SDL_PollEvent has just brought the keyboard state up to date
+    input.keys = readKeys(keyState);
+
+    return input;
+
+}
+
+//Starts or stops the tone. The device is only touched when the state actually changes
+void setSound(SDL_AudioDeviceID dev, bool on, bool & playing) {
+
+    if (on != playing) {
+
+        SDL_PauseAudioDevice(dev, on ? 0 : 1);
+        playing = on;
+
+    }
+
+}
+
+//Prints how much of the program ran as superinstructions. Only the Block backend fuses instructions
+void printFusionStats(const Chip8 & chip8, const char * rom) {
+
+    printf("Fusion hit rates for %s (%llu instructions):\n", rom, chip8.instructionCount);
+
+    for (int i = 0; i < FUSION_COUNT; i++) {
+
+        double rate = (chip8.instructionCount > 0) ? 100.0 * chip8.fusionHits[i] / chip8.instructionCount : 0;
+        printf("    %-16s %6.2f%%\n", FUSION_NAMES[i], rate);
+
+    }
+
+}
+
+//Run-ahead: emulates frames more frames with the current input, copies the display they end on into frame and then puts
+//the machine back the way it was. Showing that frame lets the player see the reaction to their input that many frames early
+void runAhead(Chip8 & chip8, Chip8::Snapshot & snapshot, int frames, Frame & frame) {
+
+    chip8.saveState(snapshot);
+    //Anything these frames run into happens again, and is reported, when the real frames get there
+    chip8.quiet = true;
+
+    for (int i = 0; i < frames && chip8.running; i++) {
+
+        chip8.runFrame();
+
+    }
+
+    std::copy_n(chip8.display, DISPLAY_HEIGHT, frame.rows);
+    chip8.restoreState(snapshot);
+    chip8.quiet = false;
+
+}
+
+//Prints how much CPU time run-ahead took on average per frame
+void printRunAheadCost(int frames, std::chrono::duration<double, std::milli> time, unsigned long long count) {
+
+    if (count == 0) return;
+
+    double perFrame = time.count() / count;
+    printf("Run-ahead of %d frames cost %.3f ms per frame (%.1f%% of a 60 Hz frame)\n", frames, perFrame,
+        100 * perFrame / std::chrono::duration<double, std::milli>(FRAME_DURATION).count());
+
+}
+
+//Shows how many times faster than real time the emulator is running in the window title, updated twice a second.
+//speedTime and speedFrames are when and at which frame the title was last updated
+void showTurboSpeed(SDL_Window * win, unsigned long long frames, std::chrono::steady_clock::time_point & speedTime,
+    unsigned long long & speedFrames) {
+
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - speedTime;
+
+    if (elapsed.count() >= 0.5) {
+
+        char title [64];
+        snprintf(title, sizeof(title), "CHIP8 - turbo %.1fx", (frames - speedFrames) / elapsed.count() / 60);
+        SDL_SetWindowTitle(win, title);
+        speedTime = now;
+        speedFrames = frames;
+
+    }
+
+}
+
+//The emulation thread in --thread mode. Runs frames paced at 60 Hz (or flat out in turbo mode) and publishes the display
+//whenever it changes. It never touches SDL so a slow present on the main thread can't hold it up
+void emulate(Chip8 & chip8, SharedState & shared, int frameSkip, int runAheadFrames) {
+
+    FramePacer pacer(FRAME_DURATION);
+    const std::chrono::microseconds spinMargin = pacer.spinMargin;
+    unsigned long long frames = 0;
+    Chip8::Snapshot snapshot;
+    std::chrono::duration<double, std::milli> runAheadTime(0);
+    unsigned long long runAheadCount = 0;
+
+    while (!shared.quit.load() && chip8.running) {
+
+        if (shared.paused.load()) {
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            pacer.resync();
+            continue;
+
+        }
+
+        chip8.setKeys(shared.keys.load(std::memory_order_relaxed));
+        chip8.runFrame();
+        frames++;
+
+        bool turbo = shared.turbo.load(std::memory_order_relaxed);
+        shared.soundOn.store(chip8.soundTimer > 0, std::memory_order_relaxed);
+        shared.frames.store(frames, std::memory_order_relaxed);
+
+        if (runAheadFrames > 0 && !turbo) {
+
+            //What's on screen can change because of the frames ahead even when the real frame didn't draw anything
+            auto aheadStart = std::chrono::steady_clock::now();
+            runAhead(chip8, snapshot, runAheadFrames, shared.display.back());
+            runAheadTime += std::chrono::steady_clock::now() - aheadStart;
+            runAheadCount++;
+            shared.display.publish();
+            chip8.dirtyRows = 0;
+
+        }
+        else if (chip8.dirtyRows != 0 && (!turbo || frames % frameSkip == 0)) {
+
+            std::copy_n(chip8.display, DISPLAY_HEIGHT, shared.display.back().rows);
+            shared.display.publish();
+            chip8.dirtyRows = 0;
+
+        }
+
+        if (shared.reportRequested.exchange(false)) {
+
+            pacer.printReport();
+
+        }
+
+        if (turbo) {
+
+            pacer.resync();
+
+        }
+        else {
+
+            //Frame timing only needs to be tight while someone can see the frames
+            pacer.spinMargin = shared.presenting.load(std::memory_order_relaxed) ? spinMargin : std::chrono::microseconds(0);
+            pacer.wait();
+
+        }
+
+    }
+
+    pacer.printReport();
+    printRunAheadCost(runAheadFrames, runAheadTime, runAheadCount);
+    shared.quit = true;
+
+}
+
+int main(int argc, char *argv []) {
+
+    Chip8 chip8;
     //Keeps the main loop running
     bool running = true;
-    //16 8 bit registers. Registers are labled V0 to VF. Note: VF is a special register that is used as a flag register
-    Uint8 registers [16];
-    std::fill_n(registers, 16, 0);
-    //Used for configuration purposes
-    bool originalRightShift = false;
-    bool originalLeftShift = false;
-    bool originalOffsetJmp = false;
-    bool originalStore = false;
-    bool originalLoad = false;
-
-    //Font data
-    unsigned char font [80] = {
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+    //Turbo mode runs frames back to back as fast as the host allows and only draws one in every frameSkip of them
+    bool turbo = false;
+    int frameSkip = 10;
+    //Vsync mode presents once per display refresh and lets that pace the loop instead of the frame pacer
+    bool vsync = false;
+    //Runs the core on its own thread while this one handles events, audio and presenting
+    bool threaded = false;
+    //Lets the audio device's clock pace the emulator instead of the frame pacer
+    bool audioSync = false;
+    //How many frames ahead run-ahead mode shows. 0 turns it off
+    int runAheadFrames = 0;
+    Background background = Background::Throttle;
+    WindowState window;
+    Palette palette = DEFAULT_PALETTE;
+    Filter filter = Filter::None;
+
+    //Quirk flags from the command line, as a combination of the QUIRK_ flags
+    int quirks = 0;
+
+    std::unordered_map<std::string, Chip8::Backend> backends = {
+        {"switch", Chip8::Backend::Switch}, {"table", Chip8::Backend::Table}, {"cached", Chip8::Backend::Cached},
+        {"block", Chip8::Backend::Block}, {"jit", Chip8::Backend::Jit}, {"threaded", Chip8::Backend::Threaded},
+        {"compiled", Chip8::Backend::Compiled}
+    };
+
+    std::unordered_map<std::string, Chip8::Timing> timings = {
+        {"frame", Chip8::Timing::Frame}, {"flat", Chip8::Timing::Flat}, {"vip", Chip8::Timing::Vip}
     };
 
-    //Maps hex digits to the SDL2 scancodes they correspond to
-    std::unordered_map<int, int> hexToScan = {
-        {1, SDL_SCANCODE_1}, {2, SDL_SCANCODE_2}, {3, SDL_SCANCODE_3}, {0xC, SDL_SCANCODE_4},
-        {4, SDL_SCANCODE_Q}, {5, SDL_SCANCODE_W}, {6, SDL_SCANCODE_E}, {0xD, SDL_SCANCODE_R},
-        {7, SDL_SCANCODE_A}, {8, SDL_SCANCODE_S}, {9, SDL_SCANCODE_D}, {0xE, SDL_SCANCODE_F},
-        {0xA, SDL_SCANCODE_Z}, {0, SDL_SCANCODE_X}, {0xB, SDL_SCANCODE_C}, {0xF, SDL_SCANCODE_V}
+    std::unordered_map<std::string, Background> backgrounds = {
+        {"run", Background::Run}, {"throttle", Background::Throttle}, {"pause", Background::Pause}
     };
 
-    //Maps SDL2 scancodes to the hex digits they correspond to
-    std::unordered_map<int, int> scanToHex = {
-        {SDL_SCANCODE_1, 1}, {SDL_SCANCODE_2, 2}, {SDL_SCANCODE_3, 3}, {SDL_SCANCODE_4, 0xC},
-        {SDL_SCANCODE_Q, 4}, {SDL_SCANCODE_W, 5}, {SDL_SCANCODE_E, 6}, {SDL_SCANCODE_R, 0xD},
-        {SDL_SCANCODE_A, 7}, {SDL_SCANCODE_S, 8}, {SDL_SCANCODE_D, 9}, {SDL_SCANCODE_F, 0xE},
-        {SDL_SCANCODE_Z, 0xA}, {SDL_SCANCODE_X, 0}, {SDL_SCANCODE_C, 0xB}, {SDL_SCANCODE_V, 0xF}
+    std::unordered_map<std::string, Palette> palettes = {
+        {"mono", DEFAULT_PALETTE}, {"green", {0xFF0A1A0A, 0xFF33FF66}}, {"amber", {0xFF1A1000, 0xFFFFB000}},
+        {"lcd", {0xFF0F380F, 0xFF9BBC0F}}
     };
 
-    std::unordered_map<char, bool*> flags = {
-        {'l', &originalLeftShift}, {'r', &originalRightShift}, {'o', &originalOffsetJmp}, {'s', &originalStore}, {'d', &originalLoad}
+    std::unordered_map<std::string, Filter> filters = {
+        {"none", Filter::None}, {"scale2x", Filter::Scale2x}, {"scale3x", Filter::Scale3x}
     };
 
-    //Loading font data into memory. Convention is to start storing the font data at 0x050 (0d80)
-    for (unsigned int i = 0; i < 80; i++) {
+    if (argc < 2) {
 
-        (memory[i + 80]) = font[i];
+        printf("Usage: %s <ROM> [-lrosd] [--backend=switch|table|cached|block|jit|threaded|compiled] [--timing=frame|flat|vip] [--turbo] [--frameskip=N] [--vsync] [--thread] [--audio-sync] [--runahead=N] [--background=run|throttle|pause] [--palette=mono|green|amber|lcd] [--fg=RRGGBB] [--bg=RRGGBB] [--filter=none|scale2x|scale3x]\n", argv[0]);
+        return 1;
 
     }
 
     //Deal with config flags
-    //If a flag is upper case use the modern behavior for that associated instruction
     for (int i = 2; i < argc; i++) {
 
         std::string flag = argv[i];
-        if (flag[0] != '-') {
+        if (flag.rfind("--backend=", 0) == 0) {
+
+            std::string name = flag.substr(10);
+            if (backends.find(name) != backends.end()) {
 
-            printf("Invalid flag: %s. Option will be ignored. Prepend '-'\n", flag);
+                chip8.backend = backends[name];
+
+            }
+            else {
+
+                printf("Invalid backend: %s. Option will be ignored\n", name.c_str());
+
+            }
 
         }
-        else {
+        else if (flag.rfind("--timing=", 0) == 0) {
 
-            for (int j = 1; j < flag.length(); j++) {
+            std::string name = flag.substr(9);
+            if (timings.find(name) != timings.end()) {
 
-                if (flags.find(tolower(flag[j])) != flags.end()) {
+                chip8.timing = timings[name];
 
-                    bool * config = flags[tolower(flag[j])];
-                    *config = (isupper(flag[j])) ? false : true;
+            }
+            else {
 
-                }
-                else {
+                printf("Invalid timing: %s. Option will be ignored\n", name.c_str());
 
-                    printf("Invalid flag: %c. Option will be ignored\n", flag[j]);
+            }
 
-                }
+        }
+        else if (flag.rfind("--filter=", 0) == 0) {
+
+            std::string name = flag.substr(9);
+            if (filters.find(name) != filters.end()) {
+
+                filter = filters[name];
+
+            }
+            else {
+
+                printf("Invalid filter: %s. Option will be ignored\n", name.c_str());
+
+            }
+
+        }
+        else if (flag.rfind("--palette=", 0) == 0) {
+
+            std::string name = flag.substr(10);
+            if (palettes.find(name) != palettes.end()) {
+
+                palette = palettes[name];
+
+            }
+            else {
+
+                printf("Invalid palette: %s. Option will be ignored\n", name.c_str());
+
+            }
+
+        }
+        else if (flag.rfind("--fg=", 0) == 0 || flag.rfind("--bg=", 0) == 0) {
+
+            std::string colour = flag.substr(5);
+            if (colour.length() == 6 && colour.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos) {
+
+                Uint32 argb = 0xFF000000 | (Uint32)strtoul(colour.c_str(), NULL, 16);
+                if (flag[2] == 'f') palette.on = argb;
+                else palette.off = argb;
+
+            }
+            else {
+
+                printf("Invalid colour: %s. Expected RRGGBB. Option will be ignored\n", colour.c_str());
 
             }
 
         }
+        else if (flag.rfind("--background=", 0) == 0) {
+
+            std::string name = flag.substr(13);
+            if (backgrounds.find(name) != backgrounds.end()) {
+
+                background = backgrounds[name];
+
+            }
+            else {
+
+                printf("Invalid background policy: %s. Option will be ignored\n", name.c_str());
+
+            }
+
+        }
+        else if (flag.rfind("--runahead=", 0) == 0) {
+
+            runAheadFrames = std::max(0, atoi(flag.c_str() + 11));
+
+        }
+        else if (flag == "--audio-sync") {
+
+            audioSync = true;
+
+        }
+        else if (flag == "--thread") {
+
+            threaded = true;
+
+        }
+        else if (flag == "--vsync") {
+
+            vsync = true;
+
+        }
+        else if (flag == "--turbo") {
+
+            turbo = true;
+
+        }
+        else if (flag.rfind("--frameskip=", 0) == 0) {
+
+            frameSkip = std::max(1, atoi(flag.c_str() + 12));
+
+        }
+        else if (!parseQuirkFlags(argv[i], quirks)) {
+
+            printf("Invalid flag: %s. Option will be ignored. Prepend '-'\n", flag.c_str());
+
+        }
         
     }
 
+    chip8.setQuirks(quirks);
+
+    if (chip8.backend == Chip8::Backend::Compiled && !Chip8::hasCompiledRom()) {
+
+        printf("No compiled ROM is linked in (see aot.cpp). Using the cached backend\n");
+        chip8.backend = Chip8::Backend::Cached;
+
+    }
+
+    if (audioSync && (threaded || vsync)) {
+
+        printf("--audio-sync can't be combined with --thread or --vsync. Option will be ignored\n");
+        audioSync = false;
+
+    }
+
+    if (runAheadFrames > 0 && vsync && !threaded) {
+
+        printf("--runahead needs whole frames so it can't be combined with --vsync without --thread. ");
+        printf("Option will be ignored\n");
+        runAheadFrames = 0;
+
+    }
+
     //Initialize SDL
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
 
@@ -165,7 +591,12 @@ int main(int argc, char *argv []) {
     SDL_Window * win = NULL;
     SDL_Renderer * render = NULL;
 
-    win = SDL_CreateWindow("CHIP8", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    //The window is the whole multiple of the (filtered) display closest to SCREEN_WIDTH x SCREEN_HEIGHT, and the renderer
+    //only scales by whole numbers, so every pixel the filter produces comes out the same size
+    int textureWidth = DISPLAY_WIDTH * filterScale(filter), textureHeight = DISPLAY_HEIGHT * filterScale(filter);
+    int zoom = std::max((SCREEN_WIDTH + textureWidth / 2) / textureWidth, 1);
+
+    win = SDL_CreateWindow("CHIP8", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, textureWidth * zoom, textureHeight * zoom, 0);
 
     if (win == NULL) {
 
@@ -173,7 +604,7 @@ int main(int argc, char *argv []) {
 
     }
 
-    render = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+    render = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
 
     if (render == NULL) {
 
@@ -181,73 +612,179 @@ int main(int argc, char *argv []) {
 
     }
     
-    SDL_RenderSetLogicalSize(render, LOGICAL_WIDTH, LOGICAL_HEIGHT);
+    SDL_RenderSetLogicalSize(render, textureWidth, textureHeight);
+    SDL_RenderSetIntegerScale(render, SDL_TRUE);
+    std::unique_ptr<Screen> screen(new Screen(render, palette, filter));
 
     //Audio setup
     SDL_AudioSpec want;
     want.freq = FREQUENCY;
     want.format = AUDIO_S16SYS;
     want.channels = 1;
-    want.samples = 4096;
-    want.callback = playBuffer;
+    want.samples = (audioSync) ? AUDIO_SYNC_SAMPLES : 4096;
+    want.callback = (audioSync) ? playSynced : playBuffer;
     want.userdata = NULL;
 
     SDL_AudioDeviceID dev = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
 
-    
+    //The emulator still runs without sound, but nothing would ever drain the audio sync queue
+    if (dev == 0) {
+
+        printf("Error opening audio device: %s. Sound is off\n", SDL_GetError());
+
+        if (audioSync) {
+
+            printf("--audio-sync needs an audio device. Falling back to the frame pacer\n");
+            audioSync = false;
+
+        }
+
+    }
+
     for (int i = 0; i < BUFFER_LEN; i++) {
 
         buffer[i] = format(tone(440, i), 0.5);
 
     }
 
-    // //Test code
+    //Load the ROM data into memory
+    if (!chip8.loadRom(argv[1])) {
 
-    // SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
-    // SDL_RenderClear(render);
+        std::cout << "Error: ROM could not be opened. Please make sure the file path is correct." << std::endl;
+        running = false;
 
-    // SDL_SetRenderDrawColor(render, 255, 255, 255, 255);
-    // SDL_RenderDrawPoint(render, 0, 0);
+    }
 
-    // SDL_RenderPresent(render);
+    //Used for input handling
+    int keyArrSize = 0;
+    const Uint8 * keyState = SDL_GetKeyboardState(&keyArrSize);
+    //Audio devices start out paused
+    bool soundPlaying = false;
 
-    // SDL_Delay(10000);
+    FramePacer pacer(FRAME_DURATION);
+    const std::chrono::microseconds spinMargin = pacer.spinMargin;
+    unsigned long long frames = 0;
+    //Used to measure how fast turbo mode is going
+    auto speedTime = std::chrono::steady_clock::now();
+    unsigned long long speedFrames = 0;
 
-    //Load the ROM data into memory
-    std::fstream rom;
-    rom.open(argv[1], std::ios::in | std::ios::binary | std::ios::ate);
+    //Display refresh rate for vsync mode. It starts out as whatever the display mode claims and is then measured from how
+    //often presents actually go through, so the emulation keeps the right speed even if the driver ignores vsync
+    int refreshRate = 60;
+    SDL_DisplayMode mode;
 
-    if (rom.is_open()) {
+    if (win != NULL && SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(win), &mode) == 0 && mode.refresh_rate > 0) {
 
-        unsigned int i = 0;
-        int size = rom.tellg();
-        rom.seekg(0, std::ios::beg);
+        refreshRate = mode.refresh_rate;
 
-        while (i < size) {
+    }
 
-            rom.read((char *)(&memory[i + 512]), 1);
-            i++;
+    auto refreshTime = std::chrono::steady_clock::now();
+    int presents = 0;
 
-        }
+    //Run-ahead state and how much time it has cost
+    Chip8::Snapshot snapshot;
+    Frame aheadFrame;
+    std::chrono::duration<double, std::milli> runAheadTime(0);
+    unsigned long long runAheadCount = 0;
 
-    }
-    else {
+    //In --thread mode this thread only handles events, keys, audio and presenting. It presents the newest frame the
+    //emulation thread finished at most once per refresh (or per 60 Hz frame without vsync)
+    if (threaded && running) {
 
-        std::cout << "Error: ROM could not be opened. Please make sure the file path is correct." << std::endl;
-        running = false;
+        SharedState shared;
+        std::thread emulation(emulate, std::ref(chip8), std::ref(shared), frameSkip, runAheadFrames);
+        FramePacer renderPacer(FRAME_DURATION);
+        //A frame came in that hasn't been drawn yet
+        bool pending = false;
 
-    }
+        while (!shared.quit.load()) {
 
-    //SDL_PauseAudioDevice(dev, 0);
-    auto lastTime = std::chrono::high_resolution_clock::now();
-    auto lastTimerTime = lastTime;
+            if (bufferPos >= BUFFER_LEN) {
 
-    //Used for input handling
-    int keyArrSize = 0;
-    const Uint8 * keyState = SDL_GetKeyboardState(&keyArrSize);
+                bufferPos = 0;
+
+            }
 
-    //The main loop
-    while (running) {
+            Input input = pollInput(keyState, window);
+
+            if (input.quit) shared.quit = true;
+
+            //Paused in the background. Sleep until something happens to the window
+            if (background == Background::Pause && (!window.visible || !window.focused) && !input.quit) {
+
+                shared.paused = true;
+                setSound(dev, false, soundPlaying);
+                SDL_WaitEvent(NULL);
+                continue;
+
+            }
+
+            shared.paused = false;
+
+            if (input.toggleTurbo) {
+
+                shared.turbo = !shared.turbo.load();
+                speedTime = std::chrono::steady_clock::now();
+                speedFrames = shared.frames.load();
+                SDL_SetWindowTitle(win, "CHIP8");
+
+            }
+
+            if (input.report) shared.reportRequested = true;
+
+            shared.keys.store(input.keys, std::memory_order_relaxed);
+            setSound(dev, shared.soundOn.load(std::memory_order_relaxed), soundPlaying);
+
+            if (window.repaint) {
+
+                screen->invalidate();
+                pending = true;
+                window.repaint = false;
+
+            }
+
+            //With vsync the present is what paces this loop so it happens every refresh, new frame or not. Frames that came
+            //in while the window couldn't be seen are drawn once it can. Frames that didn't change any rows aren't
+            bool presenting = window.visible || background == Background::Run;
+            shared.presenting.store(presenting, std::memory_order_relaxed);
+            pending |= shared.display.update();
+
+            if (presenting && pending) {
+
+                if (screen->update(shared.display.front().rows) || vsync) screen->present();
+                pending = false;
+
+            }
+            else if (presenting && vsync) {
+
+                screen->present();
+
+            }
+
+            if (shared.turbo.load()) {
+
+                showTurboSpeed(win, shared.frames.load(), speedTime, speedFrames);
+
+            }
+
+            if (!vsync || !presenting) {
+
+                renderPacer.spinMargin = presenting ? spinMargin : std::chrono::microseconds(0);
+                renderPacer.wait();
+
+            }
+
+        }
+
+        emulation.join();
+        running = false;
+
+    }
+
+    //The main loop. Each pass emulates one frame: read input, run a frame's worth of instructions and tick the timers
+    //once, draw once and then sleep until the next frame is due
+    while (running && chip8.running) {
 
         if (bufferPos >= BUFFER_LEN) {
 
@@ -255,511 +792,200 @@ int main(int argc, char *argv []) {
             
         }
 
-        //If the sound timer isn't 0, a tone is played
-        if (soundTimer > 0) {
+        //Allows user to close window
+        Input input = pollInput(keyState, window);
+
+        if (input.quit) running = false;
+
+        if (window.repaint) {
+
+            screen->invalidate();
+            chip8.dirtyRows = ALL_ROWS;
+            window.repaint = false;
+
+        }
+
+        //Paused in the background. Sleep until something happens to the window
+        if (background == Background::Pause && (!window.visible || !window.focused) && running) {
+
+            setSound(dev, false, soundPlaying);
+            SDL_WaitEvent(NULL);
+            pacer.resync();
+            continue;
+
+        }
+
+        //Nobody can see the window so there's no point drawing
+        bool presenting = window.visible || background == Background::Run;
+        bool vsyncPaced = vsync && !turbo && presenting;
+
+        if (input.toggleTurbo) {
+
+            turbo = !turbo;
+            speedTime = std::chrono::steady_clock::now();
+            speedFrames = frames;
+            SDL_SetWindowTitle(win, "CHIP8");
+
+        }
+
+        if (input.report) pacer.printReport();
+
+        chip8.setKeys(input.keys);
 
-            SDL_PauseAudioDevice(dev, 0);
+        if (vsyncPaced) {
+
+            //1/refreshRate of a second. The instruction rate and the 60 Hz timers come out the same whatever the refresh rate
+            chip8.runFrameSlice(refreshRate);
 
         }
         else {
 
-            SDL_PauseAudioDevice(dev, 1);
+            chip8.runFrame();
 
         }
 
-        //Allows user to close window
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
+        frames++;
 
-            switch(event.type) {
+        bool ahead = runAheadFrames > 0 && !turbo;
+
+        if (ahead) {
+
+            auto aheadStart = std::chrono::steady_clock::now();
+            runAhead(chip8, snapshot, runAheadFrames, aheadFrame);
+            runAheadTime += std::chrono::steady_clock::now() - aheadStart;
+            runAheadCount++;
+
+        }
+
+        //If the sound timer isn't 0, a tone is played. Audio sync mode keeps the device running and plays silence instead
+        if (audioSync) {
+
+            if (!turbo) queueSound(chip8.soundTimer > 0);
+            setSound(dev, true, soundPlaying);
+
+        }
+        else {
+
+            setSound(dev, chip8.soundTimer > 0, soundPlaying);
+
+        }
+
+        if (!presenting) {
+
+            //dirtyRows stays set so the display is drawn once the window can be seen again
+
+        }
+        else if (ahead) {
+
+            //What's on screen can change because of the frames ahead even when the real frame didn't draw anything
+            if (screen->update(aheadFrame.rows)) screen->present();
+            chip8.dirtyRows = 0;
+
+        }
+        else if (vsyncPaced) {
+
+            //Exactly one present per refresh, changed or not. It blocks until the vertical blank, which paces the loop
+            screen->update(chip8.display, chip8.dirtyRows);
+            screen->present();
+            chip8.dirtyRows = 0;
+            presents++;
+
+            auto now = std::chrono::steady_clock::now();
+            std::chrono::duration<double> elapsed = now - refreshTime;
+
+            if (elapsed.count() >= 1) {
+
+                int measured = (int)(presents / elapsed.count() + 0.5);
+                refreshRate = std::max(measured, 1);
+                refreshTime = now;
+                presents = 0;
 
-                case SDL_QUIT:
-                    running = false;
-                    SDL_CloseAudioDevice(dev);
-                    break;
-    
             }
 
         }
+        //In turbo mode skipped frames leave dirtyRows set so the next frame that is drawn still picks up their changes. A
+        //frame whose rows all ended up as they were (a sprite drawn and erased again) isn't uploaded or presented
+        else if (chip8.dirtyRows != 0 && (!turbo || frames % frameSkip == 0)) {
 
-        //We need to do this to slow down the emulator
-        auto currentTime = std::chrono::high_resolution_clock::now();
+            if (screen->update(chip8.display, chip8.dirtyRows)) screen->present();
+            chip8.dirtyRows = 0;
 
-        //Difference of times in milliseconds
-        auto diff = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(currentTime - lastTime).count();
-        auto timerDiff = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(currentTime - lastTimerTime).count();
+        }
 
-        //If 1/60th of a second has passed, decrement timers
-        if (timerDiff > timerSpeed) {
-            
-            delayTimer += (delayTimer > 0) ? -1 : 0;
-            soundTimer += (soundTimer > 0) ? -1 : 0;
-            lastTimerTime = currentTime;
-
-        }
-
-        if (diff > clockSpeed) {
-
-            lastTime = currentTime;
-
-            //Fetch an instruction from memory
-            Uint8 upper, lower;
-            Uint16 instruction;
-            upper = memory[programCounter];
-            lower = memory[programCounter + 1];
-
-            //Increment program counter by two to prepare to fetch next instruction
-            programCounter += 2;
-
-            //Instruction decode
-            //First nibble of the instruction determines which instruction category is being run
-            short X = upper & 0x0F;
-            short Y = (lower & 0xF0) >> 4;
-            switch (upper & 0xF0) {
-
-                //Execute machine language routine and clear screen instructions
-                case 0x00:
-                    switch ((((short) upper & 0x0F) << 8) | (short) lower) {
-                        //Clear instruction - sets all pixels to off
-                        case 0x00E0:
-                            SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
-                            SDL_RenderClear(render);
-                            SDL_RenderPresent(render);
-                            for (int i = 0; i < 64; i++) {
-
-                                for (int j = 0; j < 32; j++) {
-
-                                    display[i][j] = false;
-
-                                }
-
-                            }
-                            break;
-                        //Subroutine return - this instruction is called whenever a subroutine returns. Sets the program counter to the top of
-                        //the stack
-                        case 0x00EE:
-                            stackIndex--;
-                            programCounter = stack[stackIndex];
-                            break;
-                        //Execute machine language routine - doesn't need to be implemented
-                        default:
-                            break;
-                    }
-                    break;
-                //Jump instruction - takes the form 1NNN where NNN is the address the program counter is set to
-                case 0x10:
-                    programCounter = (((short) upper & 0x0F) << 8) | lower;
-                    break;
-                //Subroutine instruction - takes the form 2NNN. Calls the subroutine at memory address NNN; push the current PC onto the stack
-                //before jumping
-                case 0x20:
-                    {
-                    if (stackIndex > 15) {
-
-                        printf("Error: stack overflow\n");
-                        running = false;
-
-                    }
-                    else {
-
-                        short num = (((short) upper & 0x0F) << 8) | lower;
-                        stack[stackIndex] = programCounter;
-                        programCounter = num;
-                        stackIndex++;
-
-                    }
-                    }
-                    break;
-                //Conditional jump instruction - takes the form 3XNN where if the value of VX == NN then the next instruction is skipped
-                //Verified
-                case 0x30:
-                    if (registers[X] == lower) {
-
-                        programCounter += 2;
-
-                    }
-                    break;
-                //Conditional jump instruction - takes the form 4XNN where if the values of VX != NN then the next instruction is skipped
-                //Verified
-                case 0x40:
-                    if (registers[X] != lower) {
-
-                        programCounter += 2;
-
-                    }
-                    break;
-                //Conditional jump instruction - takes the form 5XY0 where if VX == VY then the next instruction is skipped
-                //Verified
-                case 0x50:
-                    if (registers[X] == registers[Y]) {
-
-                        programCounter += 2;
-
-                    }
-                    break;
-                //Set register instruction - takes the form 6XNN; sets the register VX to the value NN
-                //Verified
-                case 0x60:
-                    registers[X] = lower;
-                    break;
-                //Add instruction - takes the form 7XNN; adds NN to the register VX
-                //Verified
-                case 0x70:
-                    registers[X] += lower;
-                    break;
-                //All 8000 instructions are arithmetic or logical - the exact instruction is determined by the lowest nibble; note that none of
-                //these instructions affect VY
-                case 0x80:
-                    switch (lower & 0x0F) {
-
-                        //Set instruction - takes form 8XY0 and sets the value of VX to the value of VY
-                        case 0x00:
-                            registers[X] = registers[Y];
-                            break;
-                        //Binary OR instruction - takes form 8XY1 and sets the value of VX to VY | VX
-                        //Verified
-                        case 0x01:
-                            registers[X] = registers[X] | registers[Y];
-                            break;
-                        //Binary AND instruction - sets value of VX to VX & VY
-                        //Verified
-                        case 0x02:
-                            registers[X] = registers[X] & registers[Y];
-                            break;
-                        //Logical XOR - sets value of VX to VX XOR VY
-                        //Verified
-                        case 0x03:
-                            registers[X] = (~registers[X] & registers[Y]) | (registers[X] & ~registers[Y]);
-                            break;
-                        //Add - Sets the value of VX to VX + VY; affects carry flag
-                        case 0x04:
-                            {
-                            unsigned short prev = registers[X];
-                            registers[X] += registers[Y];
-                            registers[0xF] = (prev > registers[X]) ? 1 : 0;
-                            }
-                            break;
-                        //Subtract - sets the value of VX to VX - VY; VF is set to 1 if VX > VY
-                        //Verified
-                        case 0x05:
-                            {
-                            unsigned short prev = registers[X];
-                            registers[X] -= registers[Y];
-                            registers[0xF] = (prev >= registers[Y]) ? 1 : 0;
-                            }
-                            break;
-                        //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
-                        //Right shift - in the original implementation, set VX = VY and shift VX right by one; set VF to the shifted bit
-                        //In later implementations, shift VX in place and ignore VY
-                        //Verified
-                        case 0x06:
-                            {
-                            if (originalRightShift) {
-
-                                registers[X] = registers[Y];
-                                unsigned short prev = registers[X];
-                                registers[X] = registers[X] >> 1;
-                                registers[0x0F] = ((prev & 1) == 1) ? 1 : 0;
-
-                            }
-                            else {
-
-                                unsigned short prev = registers[X];
-                                registers[X] = registers[X] >> 1;
-                                registers[0x0F] = ((prev & 1) == 1) ? 1 : 0;
-                                
-                            }
-                            }
-                            break;
-                        //Subtract - sets the value of VX to VY - VX; VF is set to 1 if VX < VY
-                        //Verified
-                        case 0x07:
-                            {
-                            unsigned short prev = registers[X];
-                            registers[X] = registers[Y] - registers[X];
-                            registers[0xF] = (prev <= registers[Y]) ? 1 : 0;
-                            }
-                            break;
-                        //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
-                        //Left shift - in the original implementation, set VX = VY and shift VX left by one; set VF to the shifted bit
-                        //In later implementations, shift VX in place and ignore VY
-                        //Verified
-                        case 0x0E:
-                            {
-                            if (originalLeftShift) {
-
-                                registers[X] = registers[Y];
-                                unsigned short prev = registers[X];
-                                registers[X] = registers[X] << 1;
-                                registers[0x0F] = ((prev & 128) == 128) ? 1 : 0;
-
-                            }
-                            else {
-
-                                unsigned short prev = registers[X];
-                                registers[X] = registers[X] << 1;
-                                registers[0x0F] = ((prev & 128) == 128) ? 1 : 0;
-
-                            }
-                            }
-                            break;
-
-                    }
-                    break;
-                //Conditional jump instruction - takes the form 9XY0 where if VX != VY then the next instruction is skipped
-                //Verified
-                case 0x90:
-                    if (registers[X] != registers[Y]) {
-
-                        programCounter += 2;
-
-                    }
-                    break;
-                //Set index register instruction - takes the form ANNN; sets I to NNNN;
-                //Verified
-                case 0xA0:
-                    indexRegister = (((short) upper & 0x0F) << 8) | (short) lower;
-                    break;
-                //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
-                //Jump with offset - Takes form DNNN in the original implementation; In the original implementation, jumps to address NNN plus
-                //the value of V0. In later implementations it takes the form DXNN and jumps to address XNN plus the value of VX
-                case 0xB0:
-                    {
-                        int jmp = (((short) upper & 0x0F) << 8) | (short) lower;
-                        programCounter = (originalOffsetJmp) ? jmp + registers[0] : jmp + registers[X];
-                    }
-                    break;
-                //Generate random number - Takes form CXNN; generates a random number, ANDs it with NN and puts the value in VX
-                case 0xC0:
-                    {
-                    std::random_device dev;
-                    std::mt19937 rng(dev());
-                    std::uniform_int_distribution<std::mt19937::result_type> dist(-32768, 32767);
-                    registers[X] = dist(rng) & lower;
-                    }
-                    break;
-                //Display instruction - takes the form DXYN; draws an N pixel tall sprite from the memory location stored at the index register
-                //to the horizontal coordinate stored in VX and vertical coordinate stored in VY. If any pixels are turned off, then VF is set
-                //to 1 (otherwise set to 0)
-                //Verified
-                case 0xD0:
-                    {
-                    char N = lower & 0x0F;
-                    short xCoord = registers[X] & 63;
-                    short yCoord = registers[Y] & 31;
-                    
-                    registers[0xF] = 0;
-
-                    for (unsigned int i = 0; i < N; i++) {
-
-                        if (Y + i > 31) break;
-
-                        char spriteData = memory[indexRegister + i];
-
-                        for (unsigned int j = 0; j < 8; j++) {
-
-                            if (xCoord + j > 63) break;
-
-                            //If the pixel is already on and the pixel in the sprite row is on, turn off the pixel and set VF to 1
-                            if (display[xCoord + j][yCoord + i] && ((spriteData << j) & 0x80) == 0x80) {
-
-                                registers[0xF] = 1;
-                                display[xCoord + j][yCoord + i] = false;
-                                SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
-                                SDL_RenderDrawPoint(render, xCoord + j, yCoord + i);
-
-                            }
-                            //If the pixel in the sprite row is on but not already on, turn the pixel on
-                            else if (((spriteData << j) & 0x80) == 0x80) {
-
-                                display[xCoord + j][yCoord + i] = true;
-                                SDL_SetRenderDrawColor(render, 255, 255, 255, 255);
-                                SDL_RenderDrawPoint(render, xCoord + j, yCoord + i);
-
-                            }
-
-                        }
-
-                    }
-
-                    SDL_RenderPresent(render);
-
-                    }
-                    break;
-                //Skip if instructions - both instructions skip based on if a key is currently being pressed or not
-                //CHIP 8 uses a hexidecimal keypad so each code corresponds to a hex digit
-                case 0xE0:
-                    switch (lower) {
-                        //Skip if key pressed - takes form EX9E; skips the next instruction if the key corresponding to the number in VX
-                        //is pressed
-                        case 0x9E:
-                            {
-                            if (keyState[hexToScan[registers[X]]] == 1) {
-
-                                programCounter += 2;
-
-                            }
-                            // short hxVal = scanCodes[sc];
-                            // programCounter += (hxVal == registers[X]) ? 2 : 0;
-                            //sc = SDL_SCANCODE_0;
-                            }
-                            break;
-                        //Skip if not key pressed - takes form EXA1; skips the next instruction if the key corresponding to the number in VX
-                        //is not being pressed
-                        case 0xA1:
-                            {
-                            if (keyState[hexToScan[registers[X]]] == 0) {
-
-                                programCounter += 2;
-                                
-                            }
-                            // short hxVal = scanCodes[sc];
-                            // programCounter += (hxVal != registers[X]) ? 2 : 0;
-                            //sc = SDL_SCANCODE_0;
-                            }
-                            break;
-                    }
-                    break;
-                //Timers and miscellaneous instructions
-                //All of these instructions take the form FX~~; in other words, they all interpret the 3rd nibble as a register
-                case 0xF0:
-                    switch (lower) {
-                        //These first three are timer related instructions
-                        //Sets VX equal to the value of the delay timer
-                        case 0x07:
-                            registers[X] = delayTimer;
-                            break;
-                        //Sets the delay timer equal to value in VX
-                        case 0x15:
-                            delayTimer = registers[X];
-                            break;
-                        //Sets the sound timer to the value in VX
-                        case 0x18:
-                            soundTimer = registers[X];
-                            break;
-                        //Add the value in VX to I
-                        //NOTE: in the original implementation this did not affect VF but this implementation will since some later
-                        //implementations expect this behavior
-                        case 0x1E:
-                            {
-                            unsigned short prev = indexRegister;
-                            indexRegister += registers[X];
-                            registers[0xF] = (prev > indexRegister) ? 1 : 0;
-                            }
-                            break;
-                        //Get key - this instruction blocks until a key is pressed (timers are still decremented regularly); once a key is
-                        //pressed its hex value is put in VX
-                        case 0x0A:
-                            {
-                                int hxVal = 0x10;
-
-                            for (auto iter : hexToScan) {
-
-                                if (keyState[iter.second] == 1) {
-
-                                    hxVal = iter.first;
-                                    break;
-
-                                }
-
-                            }
-
-                            if (hxVal != 0x10) {
-
-                                registers[X] = hxVal;
-
-                            }
-                            else {
-
-                                programCounter -= 2;
-
-                            }
-                            }
-                            break;
-                        //Sets the index register to the address of the hex character in VX (meaning the character's font data); use the last
-                        //nibble of VX
-                        case 0x29:
-                            {
-                            int hexVal = registers[X] & 0xF;
-                            indexRegister = 80 + hexVal * 5;
-                            }
-                            break;
-                        //Store each individual digit of the number in VX starting at memory[indexRegister]; in other words, store the Binary
-                        //Coded Decimal value of the number
-                        //Verified
-                        case 0x33:
-                            {
-                            Uint8 num = registers[X];
-                            Uint8 digit;
-                            std::stack<Uint8> s;
-                            int iter = 3;
-                            while (num > 0) {
-
-                                digit = num % 10;
-                                s.push(digit);
-                                num /= 10;
-                                iter--;
-
-                            }
-
-                            digit = 0;
-
-                            while (iter > 0) {
-
-                                memory[indexRegister + digit] = 0;
-                                iter--;
-                                digit++;
-                                
-                            }
-
-                            while (!s.empty()) {
-
-                                memory[indexRegister + digit] = s.top();
-                                s.pop();
-                                digit++;
-
-                            }
-                            }
-                            break;
-                        //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
-                        //Store instruction - stores all of the data in registers V0 to VX in memory at the address in the index register.
-                        //In the original implementation, this is done by incrementing the index register. In later implementations,
-                        //the index register isn't affected
-                        case 0x55:
-                            for (int i = 0; i <= X; i++) {
-
-                                memory[indexRegister + i] = registers[i];
-
-                            }
-                            indexRegister += (originalStore) ? X : 0;
-                            break;
-                        //THIS INSTRUCTION IS DIFFERENT IN SOME IMPLEMENTATIONS
-                        //Load instruction - loads data into registers V0 to VX from memory at the address in index register. Like the store
-                        //instruction, the original implementation incremented the index register while later implementations did not
-                        case 0x65:
-                            for (int i = 0; i <= X; i++) {
-
-                                registers[i] = memory[indexRegister + i];
-
-                            }
-                            indexRegister += (originalLoad) ? X : 0;
-                            break;
-                        
-                    }
-                    break;
+        if (turbo) {
+
+            showTurboSpeed(win, frames, speedTime, speedFrames);
+
+            //Picks up at normal speed from here once turbo is switched off
+            pacer.resync();
+
+        }
+        else if (audioSync) {
+
+            //The next frame runs once the audio callback is close to needing it. A device that stops asking for audio
+            //still only holds the loop up for a frame at a time
+            auto waitStart = std::chrono::steady_clock::now();
+
+            while (queuedSoundFrames() >= AUDIO_FRAMES_AHEAD && std::chrono::steady_clock::now() - waitStart < FRAME_DURATION) {
+
+                SDL_Delay(1);
 
             }
 
+            pacer.resync();
+
+        }
+        else if (vsyncPaced) {
+
+            pacer.resync();
+
+        }
+        else {
+
+            //Nobody is looking so a late frame doesn't matter and isn't worth spinning a core for
+            pacer.spinMargin = presenting ? spinMargin : std::chrono::microseconds(0);
+            pacer.wait();
+
+        }
+
+        //The refresh rate can only be measured while presents are pacing the loop
+        if (!vsyncPaced) {
+
+            refreshTime = std::chrono::steady_clock::now();
+            presents = 0;
+
         }
 
     }
 
+    screen->printReport();
+    printRunAheadCost(runAheadFrames, runAheadTime, runAheadCount);
+
+    if (audioSync) {
+
+        printf("Audio sync: %llu frames played, %llu underruns\n", (unsigned long long)soundTail.load(),
+            audioUnderruns.load());
+
+    }
+    else if (!threaded) {
+
+        pacer.printReport();
+
+    }
+
+    if (chip8.backend == Chip8::Backend::Block) {
+
+        printFusionStats(chip8, argv[1]);
+
+    }
+
     //Cleanup
-    rom.close();
-    SDL_DestroyWindow(win);
+    SDL_CloseAudioDevice(dev);
+    //The texture has to go before the renderer it belongs to
+    screen.reset();
     SDL_DestroyRenderer(render);
+    SDL_DestroyWindow(win);
     SDL_Quit();
-    delete [] memory;
 
     return 0;
 
@@ -767,7 +993,7 @@ int main(int argc, char *argv []) {
 
 //SDL_AudioCallback function
 //This code (and really most of the SDL_Audio related code) comes from https://gist.github.com/jacobsebek/10867cb10cdfccf1d6cfdd24fa23ee96
-void playBuffer(void *userdata, unsigned char *stream, int len) {
+void playBuffer(void *, unsigned char *stream, int len) {
 
     SDL_memset(stream, 0, len);
 
@@ -786,4 +1012,46 @@ void playBuffer(void *userdata, unsigned char *stream, int len) {
 
     bufferPos += len;
 
-}
\ No newline at end of file
+}
+
+//SDL_AudioCallback for audio sync mode. Plays the queued frames back one per 1/60 s of samples. If the queue runs dry the
+//last frame's sound carries on and the underrun is counted
+void playSynced(void *, unsigned char *stream, int len) {
+
+    //Where the callback is within the current frame, in 1/60 samples, and whether that frame has sound
+    static int samplePhase = 0;
+    static bool playing = false;
+
+    Sint16 * samples = (Sint16 *)stream;
+    len /= 2;
+
+    for (int i = 0; i < len; i++) {
+
+        samplePhase += 60;
+
+        if (samplePhase >= FREQUENCY) {
+
+            samplePhase -= FREQUENCY;
+
+            unsigned int tail = soundTail.load(std::memory_order_relaxed);
+
+            if (tail != soundHead.load(std::memory_order_acquire)) {
+
+                playing = soundQueue[tail % SOUND_QUEUE_SIZE];
+                soundTail.store(tail + 1, std::memory_order_release);
+
+            }
+            else {
+
+                audioUnderruns++;
+
+            }
+
+        }
+
+        samples[i] = (playing) ? buffer[bufferPos] : 0;
+        bufferPos = (bufferPos + 1) % BUFFER_LEN;
+
+    }
+
+}
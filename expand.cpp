@@ -0,0 +1,89 @@
+#include "expand.h"
+
+#if EXPAND_SIMD_SUPPORTED
+#include <immintrin.h>
+#endif
+
+void expandScalar(const uint64_t * rows, int words, int count, void * pixels, int pitch, Palette palette) {
+
+    uint32_t flip = palette.off ^ palette.on;
+
+    for (int y = 0; y < count; y++) {
+
+        uint32_t * line = (uint32_t *)((uint8_t *)pixels + y * pitch);
+
+        for (int w = 0; w < words; w++) {
+
+            uint64_t word = rows[y * words + w];
+
+            for (int x = 0; x < 64; x++) {
+
+                //All ones if the pixel is on, otherwise 0
+                uint32_t mask = 0 - (uint32_t)((word >> (63 - x)) & 1);
+                line[64 * w + x] = palette.off ^ (mask & flip);
+
+            }
+
+        }
+
+    }
+
+}
+
+#if EXPAND_SIMD_SUPPORTED
+
+//Every byte of a row is 8 pixels. The byte is copied into every 32 bit lane and each lane tests the bit for its own pixel,
+//which gives a mask of all ones for pixels that are on. The mask then picks between the two colours
+
+__attribute__((target("sse2")))
+void expandSse2(const uint64_t * rows, int words, int count, void * pixels, int pitch, Palette palette) {
+
+    const __m128i high = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i low = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    const __m128i off = _mm_set1_epi32(palette.off);
+    const __m128i flip = _mm_set1_epi32(palette.off ^ palette.on);
+
+    for (int y = 0; y < count; y++) {
+
+        __m128i * line = (__m128i *)((uint8_t *)pixels + y * pitch);
+
+        for (int i = 0; i < words * 8; i++) {
+
+            __m128i byte = _mm_set1_epi32((int)(rows[y * words + i / 8] >> (56 - 8 * (i % 8))) & 0xFF);
+            __m128i maskHigh = _mm_cmpeq_epi32(_mm_and_si128(byte, high), high);
+            __m128i maskLow = _mm_cmpeq_epi32(_mm_and_si128(byte, low), low);
+
+            _mm_storeu_si128(line + 2 * i, _mm_xor_si128(off, _mm_and_si128(maskHigh, flip)));
+            _mm_storeu_si128(line + 2 * i + 1, _mm_xor_si128(off, _mm_and_si128(maskLow, flip)));
+
+        }
+
+    }
+
+}
+
+__attribute__((target("avx2")))
+void expandAvx2(const uint64_t * rows, int words, int count, void * pixels, int pitch, Palette palette) {
+
+    const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    const __m256i off = _mm256_set1_epi32(palette.off);
+    const __m256i flip = _mm256_set1_epi32(palette.off ^ palette.on);
+
+    for (int y = 0; y < count; y++) {
+
+        __m256i * line = (__m256i *)((uint8_t *)pixels + y * pitch);
+
+        for (int i = 0; i < words * 8; i++) {
+
+            __m256i byte = _mm256_set1_epi32((int)(rows[y * words + i / 8] >> (56 - 8 * (i % 8))) & 0xFF);
+            __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+
+            _mm256_storeu_si256(line + i, _mm256_xor_si256(off, _mm256_and_si256(mask, flip)));
+
+        }
+
+    }
+
+}
+
+#endif
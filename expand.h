@@ -0,0 +1,38 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <cstdint>
+
+//Kernels that turn packed rows of one bit pixels (each row is `words` 64-bit words, with the leftmost pixel in the top bit)
+//into 32 bit host pixels. Each one writes count rows, pitch bytes apart, picking the palette's off or on colour for every pixel. They
+//all produce exactly the same pixels; the frontend picks the fastest one the CPU supports at run time
+
+//SSE2 and AVX2 versions are only built with GCC/Clang on x86, where they can be compiled for those instruction sets
+//without building the rest of the program for them
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define EXPAND_SIMD_SUPPORTED 1
+#else
+#define EXPAND_SIMD_SUPPORTED 0
+#endif
+
+//Colours of pixels that are off and on in the host pixel format (ARGB8888)
+struct Palette {
+
+    uint32_t off;
+    uint32_t on;
+
+};
+
+typedef void (*ExpandKernel)(const uint64_t * rows, int words, int count, void * pixels, int pitch, Palette palette);
+
+//Portable version, one pixel at a time
+void expandScalar(const uint64_t * rows, int words, int count, void * pixels, int pitch, Palette palette);
+
+#if EXPAND_SIMD_SUPPORTED
+//4 pixels per store
+void expandSse2(const uint64_t * rows, int words, int count, void * pixels, int pitch, Palette palette);
+//8 pixels per store
+void expandAvx2(const uint64_t * rows, int words, int count, void * pixels, int pitch, Palette palette);
+#endif
+
+#endif
@@ -0,0 +1,450 @@
+#include "jit.h"
+#include <cstddef>
+#include <cstring>
+
+#if CHIP8_JIT_SUPPORTED
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+//Size of the code buffer. When it fills up everything is thrown away and recompiled as it gets hot again
+static const size_t BUFFER_SIZE = 4 * 1024 * 1024;
+//Worst case size of one compiled block; a block of nothing but interpreter calls with every host register in use
+static const size_t MAX_BLOCK_CODE = MAX_BLOCK_LENGTH * 256 + 256;
+
+//x86-64 register numbers
+enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15, NO_REG };
+
+//Condition codes for setcc/cmovcc
+enum Cond { COND_AE = 0x3, COND_E = 0x4, COND_NE = 0x5, COND_BE = 0x6 };
+
+//Registers CHIP-8 registers can be assigned to. RAX and RCX are kept free as scratch registers and RBX holds the state
+static const Reg hostRegs [] = { RDX, RSI, RDI, RBP, R8, R9, R10, R11, R12, R13, R14, R15 };
+static const int HOST_REG_COUNT = sizeof(hostRegs) / sizeof(hostRegs[0]);
+
+//The registers the generated code has to preserve for its caller
+static const Reg savedRegs [] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+static const int SAVED_REG_COUNT = sizeof(savedRegs) / sizeof(savedRegs[0]);
+
+//The two arguments of a compiled block and of the interpreter handlers it calls
+#ifdef _WIN32
+static const Reg ARG0 = RCX, ARG1 = RDX;
+#else
+static const Reg ARG0 = RDI, ARG1 = RSI;
+#endif
+
+//Stack space reserved below the saved registers: 32 bytes of shadow space for Windows calls followed by the machine pointer.
+//8 pushes plus the return address plus this keeps the stack 16 byte aligned at every call
+static const int FRAME_SIZE = 40, MACHINE_SLOT = 32;
+
+static const int REGISTERS = offsetof(Chip8State, registers);
+static const int INDEX_REGISTER = offsetof(Chip8State, indexRegister);
+static const int PROGRAM_COUNTER = offsetof(Chip8State, programCounter);
+static const int DELAY_TIMER = offsetof(Chip8State, delayTimer);
+static const int SOUND_TIMER = offsetof(Chip8State, soundTimer);
+
+//Writes x86-64 machine code. Only the handful of encodings the compiler needs are here. All 32 bit operations zero the top
+//of the 64 bit register, which keeps every CHIP-8 register zero extended
+class Emitter {
+
+    public:
+        unsigned char * p;
+
+        Emitter(unsigned char * start) : p(start) {}
+
+        void byte(int b) { *p++ = (unsigned char) b; }
+        void imm16(int v) { byte(v); byte(v >> 8); }
+        void imm32(int v) { imm16(v); imm16(v >> 16); }
+        void imm64(unsigned long long v) { imm32((int) v); imm32((int) (v >> 32)); }
+
+        //REX prefix; only written when needed unless force is set (byte access to SPL/BPL/SIL/DIL needs one)
+        void rex(bool w, int reg, int rm, bool force = false) {
+
+            int v = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1);
+            if (v != 0x40 || force) byte(v);
+
+        }
+
+        void modrm(int reg, int rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+        //[RBX + disp32]
+        void modrmState(int reg, int disp) { byte(0x80 | ((reg & 7) << 3) | RBX); imm32(disp); }
+        //[RSP + disp8]
+        void modrmStack(int reg, int disp) { byte(0x44 | ((reg & 7) << 3)); byte(0x24); byte(disp); }
+
+        void mov(Reg dst, Reg src) { rex(false, src, dst); byte(0x89); modrm(src, dst); }
+        //ALU op with the register form opcode (ADD 01, OR 09, AND 21, SUB 29, XOR 31, CMP 39)
+        void alu(int opcode, Reg dst, Reg src) { rex(false, src, dst); byte(opcode); modrm(src, dst); }
+        //ALU op with a 32 bit immediate (ADD /0, OR /1, AND /4, SUB /5, XOR /6, CMP /7)
+        void aluImm(int ext, Reg dst, int imm) { rex(false, 0, dst); byte(0x81); modrm(ext, dst); imm32(imm); }
+        void movImm(Reg dst, int imm) { rex(false, 0, dst); byte(0xB8 + (dst & 7)); imm32(imm); }
+        //Shift by an immediate (SHL /4, SHR /5)
+        void shiftImm(int ext, Reg dst, int count) { rex(false, 0, dst); byte(0xC1); modrm(ext, dst); byte(count); }
+        void cmov(Cond cond, Reg dst, Reg src) { rex(false, dst, src); byte(0x0F); byte(0x40 | cond); modrm(dst, src); }
+        //dst = (condition) ? 1 : 0
+        void setFlag(Cond cond, Reg dst) {
+
+            byte(0x0F); byte(0x90 | cond); byte(0xC0);
+            byte(0x0F); byte(0xB6); byte(0xC0);
+            mov(dst, RAX);
+
+        }
+
+        void loadByte(Reg dst, int offset) { rex(false, dst, RBX); byte(0x0F); byte(0xB6); modrmState(dst, offset); }
+        void loadWord(Reg dst, int offset) { rex(false, dst, RBX); byte(0x0F); byte(0xB7); modrmState(dst, offset); }
+        void storeByte(int offset, Reg src) { rex(false, src, RBX, true); byte(0x88); modrmState(src, offset); }
+        void storeWord(int offset, Reg src) { byte(0x66); rex(false, src, RBX); byte(0x89); modrmState(src, offset); }
+        void storeWordImm(int offset, int imm) { byte(0x66); byte(0xC7); modrmState(0, offset); imm16(imm); }
+
+        void push(Reg r) { rex(false, 0, r); byte(0x50 + (r & 7)); }
+        void pop(Reg r) { rex(false, 0, r); byte(0x58 + (r & 7)); }
+        void mov64(Reg dst, Reg src) { rex(true, src, dst); byte(0x89); modrm(src, dst); }
+        void movImm64(Reg dst, unsigned long long imm) { rex(true, 0, dst); byte(0xB8 + (dst & 7)); imm64(imm); }
+        void storeStack(int offset, Reg src) { rex(true, src, RSP); byte(0x89); modrmStack(src, offset); }
+        void loadStack(Reg dst, int offset) { rex(true, dst, RSP); byte(0x8B); modrmStack(dst, offset); }
+        void subRsp(int imm) { byte(0x48); byte(0x83); byte(0xEC); byte(imm); }
+        void addRsp(int imm) { byte(0x48); byte(0x83); byte(0xC4); byte(imm); }
+        void callRax() { byte(0xFF); byte(0xD0); }
+        void ret() { byte(0xC3); }
+
+};
+
+//True for instructions the compiler turns into native code. Everything else becomes a call to the instruction's handler
+static bool isNative(unsigned short opcode) {
+
+    switch (opcode >> 12) {
+
+        case 0x0:
+            //0NNN is ignored by the interpreter, so there's nothing to compile
+            return opcode != 0x00E0 && opcode != 0x00EE;
+        case 0x1: case 0x3: case 0x4: case 0x6: case 0x7: case 0xA:
+            return true;
+        case 0x5: case 0x9:
+            return (opcode & 0xF) == 0;
+        case 0x8:
+            switch (opcode & 0xF) {
+                case 0x0: case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x6: case 0x7: case 0xE:
+                    return true;
+                default:
+                    return false;
+            }
+        case 0xF:
+            switch (opcode & 0xFF) {
+                //FX07 is left to the interpreter, which watches for delay timer wait loops
+                case 0x15: case 0x18: case 0x1E: case 0x29:
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+
+    }
+
+}
+
+//Marks which CHIP-8 registers a native instruction reads or writes
+static void markRegisters(const Instruction & ins, bool used [16]) {
+
+    switch (ins.opcode >> 12) {
+
+        case 0x3: case 0x4: case 0x6: case 0x7: case 0xF:
+            used[ins.x] = true;
+            break;
+        case 0x5: case 0x9:
+            used[ins.x] = used[ins.y] = true;
+            break;
+        case 0x8:
+            used[ins.x] = used[ins.y] = true;
+            if (ins.n >= 0x4) used[0xF] = true;
+            break;
+
+    }
+
+    if (ins.opcode >> 12 == 0xF && ins.nn == 0x1E) used[0xF] = true;
+
+}
+
+//The code buffer is never writable and executable at the same time. It is writable while compile() emits a block and
+//executable the rest of the time. Returns false if the protection couldn't be changed
+static bool setWritable(unsigned char * buffer, bool writable) {
+
+#ifdef _WIN32
+    DWORD oldProtection;
+    return VirtualProtect(buffer, BUFFER_SIZE, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &oldProtection) != 0;
+#else
+    return mprotect(buffer, BUFFER_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+
+}
+
+Chip8Jit::Chip8Jit() : buffer(nullptr), used(0) {
+
+#ifdef _WIN32
+    buffer = (unsigned char *) VirtualAlloc(NULL, BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void * mem = mmap(NULL, BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    buffer = (mem == MAP_FAILED) ? nullptr : (unsigned char *) mem;
+#endif
+
+}
+
+Chip8Jit::~Chip8Jit() {
+
+    if (buffer == nullptr) return;
+
+#ifdef _WIN32
+    VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+    munmap(buffer, BUFFER_SIZE);
+#endif
+
+}
+
+bool Chip8Jit::available() const {
+
+    return buffer != nullptr;
+
+}
+
+bool Chip8Jit::full() const {
+
+    return buffer == nullptr || BUFFER_SIZE - used < MAX_BLOCK_CODE;
+
+}
+
+void Chip8Jit::clear() {
+
+    used = 0;
+
+}
+
+JitCode Chip8Jit::compile(const Chip8 & machine, const Instruction * code, int length, unsigned short address) {
+
+    if (full()) return nullptr;
+
+    //Give every CHIP-8 register the block touches natively its own host register
+    bool touched [16] = {};
+    for (int i = 0; i < length; i++) {
+
+        if (isNative(code[i].opcode)) markRegisters(code[i], touched);
+
+    }
+
+    //Registers no native instruction touches stay in memory and are left as NO_REG
+    Reg host [16];
+    int allocated [16];
+    int count = 0;
+
+    for (int v = 0; v < 16; v++) {
+
+        host[v] = NO_REG;
+
+        if (!touched[v]) continue;
+        if (count == HOST_REG_COUNT) return nullptr;
+
+        host[v] = hostRegs[count];
+        allocated[count++] = v;
+
+    }
+
+    if (!setWritable(buffer, true)) return nullptr;
+
+    unsigned char * start = buffer + used;
+    Emitter e(start);
+
+    //Prologue - save the caller's registers, keep the state pointer in RBX and the machine on the stack, then load the
+    //block's registers
+    for (int i = 0; i < SAVED_REG_COUNT; i++) e.push(savedRegs[i]);
+    e.subRsp(FRAME_SIZE);
+    e.mov64(RBX, ARG0);
+    e.storeStack(MACHINE_SLOT, ARG1);
+    for (int i = 0; i < count; i++) e.loadByte(host[allocated[i]], REGISTERS + allocated[i]);
+
+    //Set once an instruction has left the program counter where the block should exit to
+    bool pcWritten = false;
+
+    for (int i = 0; i < length; i++) {
+
+        const Instruction & ins = code[i];
+        int next = (address + 2 * i + 2) & 0xFFFF;
+
+        if (!isNative(ins.opcode)) {
+
+            //Hand the instruction to the interpreter. It sees the machine exactly as it would when interpreting: registers
+            //in memory and the program counter past the instruction
+            e.storeWordImm(PROGRAM_COUNTER, next);
+            for (int r = 0; r < count; r++) e.storeByte(REGISTERS + allocated[r], host[allocated[r]]);
+            e.loadStack(ARG0, MACHINE_SLOT);
+            e.movImm64(ARG1, (unsigned long long) &ins);
+            e.movImm64(RAX, (unsigned long long) ins.handler);
+            e.callRax();
+            for (int r = 0; r < count; r++) e.loadByte(host[allocated[r]], REGISTERS + allocated[r]);
+
+            //Anything that ends a block and isn't compiled natively (calls, returns, BNNN, key skips, FX0A, stores) sets
+            //the program counter itself
+            pcWritten = true;
+            continue;
+
+        }
+
+        pcWritten = false;
+        Reg x = host[ins.x], y = host[ins.y], f = host[0xF];
+
+        switch (ins.opcode >> 12) {
+
+            case 0x0:
+                break;
+            case 0x1:
+                e.storeWordImm(PROGRAM_COUNTER, ins.nnn);
+                pcWritten = true;
+                break;
+            //Skips pick between the next instruction and the one after it
+            case 0x3: case 0x4: case 0x5: case 0x9:
+                e.movImm(RCX, next);
+                e.movImm(RAX, (next + 2) & 0xFFFF);
+                if (ins.opcode >> 12 == 0x3 || ins.opcode >> 12 == 0x4) {
+
+                    e.aluImm(7, x, ins.nn);
+
+                }
+                else {
+
+                    e.alu(0x39, x, y);
+
+                }
+                e.cmov((ins.opcode >> 12 == 0x3 || ins.opcode >> 12 == 0x5) ? COND_E : COND_NE, RCX, RAX);
+                e.storeWord(PROGRAM_COUNTER, RCX);
+                pcWritten = true;
+                break;
+            case 0x6:
+                e.movImm(x, ins.nn);
+                break;
+            case 0x7:
+                e.aluImm(0, x, ins.nn);
+                e.aluImm(4, x, 0xFF);
+                break;
+            case 0x8:
+                switch (ins.n) {
+                    case 0x0:
+                        e.mov(x, y);
+                        break;
+                    case 0x1:
+                        e.alu(0x09, x, y);
+                        break;
+                    case 0x2:
+                        e.alu(0x21, x, y);
+                        break;
+                    case 0x3:
+                        e.alu(0x31, x, y);
+                        break;
+                    //VF = carry out of bit 7
+                    case 0x4:
+                        e.mov(RAX, x);
+                        e.alu(0x01, RAX, y);
+                        e.mov(RCX, RAX);
+                        e.shiftImm(5, RCX, 8);
+                        e.aluImm(4, RAX, 0xFF);
+                        e.mov(x, RAX);
+                        e.mov(f, RCX);
+                        break;
+                    //Like the interpreter, the flag compares against VY after VX has been written
+                    case 0x5:
+                        e.mov(RCX, x);
+                        e.alu(0x29, x, y);
+                        e.aluImm(4, x, 0xFF);
+                        e.alu(0x39, RCX, y);
+                        e.setFlag(COND_AE, f);
+                        break;
+                    case 0x7:
+                        e.mov(RCX, x);
+                        e.mov(RAX, y);
+                        e.alu(0x29, RAX, x);
+                        e.aluImm(4, RAX, 0xFF);
+                        e.mov(x, RAX);
+                        e.alu(0x39, RCX, y);
+                        e.setFlag(COND_BE, f);
+                        break;
+                    case 0x6:
+                        if (machine.quirks() & QUIRK_RIGHT_SHIFT) e.mov(x, y);
+                        e.mov(RAX, x);
+                        e.shiftImm(5, x, 1);
+                        e.aluImm(4, RAX, 1);
+                        e.mov(f, RAX);
+                        break;
+                    case 0xE:
+                        if (machine.quirks() & QUIRK_LEFT_SHIFT) e.mov(x, y);
+                        e.mov(RAX, x);
+                        e.shiftImm(4, x, 1);
+                        e.aluImm(4, x, 0xFF);
+                        e.shiftImm(5, RAX, 7);
+                        e.mov(f, RAX);
+                        break;
+                }
+                break;
+            case 0xA:
+                e.storeWordImm(INDEX_REGISTER, ins.nnn);
+                break;
+            case 0xF:
+                switch (ins.nn) {
+                    case 0x15:
+                        e.storeByte(DELAY_TIMER, x);
+                        break;
+                    case 0x18:
+                        e.storeByte(SOUND_TIMER, x);
+                        break;
+                    //VF = carry out of the 16 bit index register
+                    case 0x1E:
+                        e.loadWord(RAX, INDEX_REGISTER);
+                        e.alu(0x01, RAX, x);
+                        e.storeWord(INDEX_REGISTER, RAX);
+                        e.shiftImm(5, RAX, 16);
+                        e.mov(f, RAX);
+                        break;
+                    case 0x29:
+                        e.mov(RAX, x);
+                        e.aluImm(4, RAX, 0xF);
+                        //imul eax, eax, 5
+                        e.byte(0x6B); e.byte(0xC0); e.byte(5);
+                        e.aluImm(0, RAX, FONT_START);
+                        e.storeWord(INDEX_REGISTER, RAX);
+                        break;
+                }
+                break;
+
+        }
+
+    }
+
+    //Epilogue - write the registers back and leave the program counter after the block if nothing else set it
+    if (!pcWritten) e.storeWordImm(PROGRAM_COUNTER, (address + 2 * length) & 0xFFFF);
+    for (int i = 0; i < count; i++) e.storeByte(REGISTERS + allocated[i], host[allocated[i]]);
+    e.addRsp(FRAME_SIZE);
+    for (int i = SAVED_REG_COUNT - 1; i >= 0; i--) e.pop(savedRegs[i]);
+    e.ret();
+
+    //Without execute permission the block can't run, so it's left to the interpreter and its space is used again
+    if (!setWritable(buffer, false)) return nullptr;
+
+    used += e.p - start;
+    //Keep blocks 16 byte aligned
+    used = (used + 15) & ~(size_t) 15;
+
+    return (JitCode) start;
+
+}
+
+#else
+
+//No JIT on this host; compile always fails and the Jit backend interprets blocks instead
+
+Chip8Jit::Chip8Jit() : buffer(nullptr), used(0) {}
+Chip8Jit::~Chip8Jit() {}
+bool Chip8Jit::available() const { return false; }
+bool Chip8Jit::full() const { return true; }
+void Chip8Jit::clear() {}
+JitCode Chip8Jit::compile(const Chip8 & machine, const Instruction * code, int length, unsigned short address) { return nullptr; }
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "chip8.h"
+
+//Dynamic recompiler that turns hot blocks of CHIP-8 code into native x86-64. The registers a block uses are kept in host
+//registers for the whole block. Anything that isn't worth compiling (DXYN, FX0A, the stack, memory stores, ...) is
+//compiled as a call back into the interpreter's handler for that instruction
+
+//Set when the JIT can actually run on this host. Everywhere else the Jit backend behaves like the Block backend
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+class Chip8Jit {
+
+    public:
+        Chip8Jit();
+        ~Chip8Jit();
+
+        //False if there is no executable memory to compile into
+        bool available() const;
+        //Compiles length instructions starting at address. Returns nullptr if the block can't be compiled (it uses too many
+        //registers or the code buffer is full). The instructions must stay where they are for as long as the code is used
+        JitCode compile(const Chip8 & machine, const Instruction * code, int length, unsigned short address);
+        //True once the code buffer doesn't have room for another block. Call clear() and recompile
+        bool full() const;
+        //Throws away all compiled code
+        void clear();
+
+    private:
+        unsigned char * buffer;
+        size_t used;
+
+};
+
+#endif
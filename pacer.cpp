@@ -0,0 +1,113 @@
+#include "pacer.h"
+#include <cstdio>
+#include <thread>
+#include <algorithm>
+
+FramePacer::FramePacer(Clock::duration period) : period(period) {
+
+    std::fill_n(lateness, LATENESS_BUCKET_COUNT, 0);
+    overruns = 0;
+    frames = 0;
+    worst = Clock::duration::zero();
+    sleepTime = Clock::duration::zero();
+    spinTime = Clock::duration::zero();
+    resync();
+    start = deadline;
+
+}
+
+void FramePacer::resync() {
+
+    deadline = Clock::now();
+
+}
+
+void FramePacer::wait() {
+
+    deadline += period;
+    frames++;
+
+    Clock::time_point now = Clock::now();
+
+    if (now >= deadline) {
+
+        overruns++;
+
+        //More than a frame behind (the window was being dragged, the machine was suspended, ...)
+        if (now - deadline > period) {
+
+            deadline = now;
+
+        }
+
+        return;
+
+    }
+
+    //Sleep for most of the wait
+    if (deadline - now > spinMargin) {
+
+        std::this_thread::sleep_until(deadline - spinMargin);
+
+        Clock::time_point woke = Clock::now();
+        sleepTime += woke - now;
+        now = woke;
+
+    }
+
+    //And spin for the rest
+    Clock::time_point spinStart = now;
+
+    while (now < deadline) {
+
+        now = Clock::now();
+
+    }
+
+    spinTime += now - spinStart;
+
+    Clock::duration late = now - deadline;
+    worst = std::max(worst, late);
+
+    long long micros = std::chrono::duration_cast<std::chrono::microseconds>(late).count();
+    int bucket = 0;
+
+    while (bucket < LATENESS_BUCKET_COUNT - 1 && micros >= LATENESS_BUCKETS[bucket]) {
+
+        bucket++;
+
+    }
+
+    lateness[bucket]++;
+
+}
+
+void FramePacer::printReport() const {
+
+    typedef std::chrono::duration<double, std::milli> Milliseconds;
+
+    double total = Milliseconds(Clock::now() - start).count();
+    double slept = Milliseconds(sleepTime).count();
+    double spun = Milliseconds(spinTime).count();
+
+    printf("Frame pacing over %llu frames:\n", frames);
+    printf("    Slept %.0f ms (%.1f%%), spun %.0f ms (%.1f%%) of %.0f ms\n", slept, (total > 0) ? 100 * slept / total : 0,
+        spun, (total > 0) ? 100 * spun / total : 0, total);
+    printf("    Deadline lateness (worst %.3f ms, %llu frames overran):\n", Milliseconds(worst).count(), overruns);
+
+    for (int i = 0; i < LATENESS_BUCKET_COUNT; i++) {
+
+        if (i < LATENESS_BUCKET_COUNT - 1) {
+
+            printf("        < %5d us %10llu\n", LATENESS_BUCKETS[i], lateness[i]);
+
+        }
+        else {
+
+            printf("       >= %5d us %10llu\n", LATENESS_BUCKETS[i - 1], lateness[i]);
+
+        }
+
+    }
+
+}
@@ -0,0 +1,48 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <chrono>
+
+//Keeps the frontend's main loop on a fixed frame rate. Sleeping alone tends to wake up late (by a millisecond or more
+//on a loaded host) and spinning alone burns a whole core, so wait() sleeps until shortly before the deadline and spins
+//the rest of the way. How late each deadline was actually hit is kept in a histogram
+
+//Upper bounds of the lateness histogram buckets in microseconds. Anything later goes in the last bucket
+const int LATENESS_BUCKETS [] = {50, 100, 250, 500, 1000, 2000, 4000, 8000, 16667};
+const int LATENESS_BUCKET_COUNT = sizeof(LATENESS_BUCKETS) / sizeof(LATENESS_BUCKETS[0]) + 1;
+
+class FramePacer {
+
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        //How long before the deadline to stop sleeping and start spinning
+        std::chrono::microseconds spinMargin = std::chrono::microseconds(1000);
+
+        explicit FramePacer(Clock::duration period);
+
+        //Waits until the next frame is due. Deadlines are spaced exactly one period apart so lateness doesn't add up.
+        //If the loop has fallen more than a frame behind it starts again from now rather than rushing to catch up
+        void wait();
+        //Starts pacing again from now. Used when the loop stops waiting for a while, like in turbo mode
+        void resync();
+        //Prints the lateness histogram and how the waiting time was split between sleeping and spinning
+        void printReport() const;
+
+    private:
+        Clock::duration period;
+        Clock::time_point start;
+        Clock::time_point deadline;
+
+        //Number of deadlines that were hit in each bucket
+        unsigned long long lateness [LATENESS_BUCKET_COUNT];
+        //Frames where the work alone ran past the deadline, so there was nothing to wait for
+        unsigned long long overruns;
+        unsigned long long frames;
+        Clock::duration worst;
+        Clock::duration sleepTime;
+        Clock::duration spinTime;
+
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "screen.h"
+#include <cstdio>
+#include <algorithm>
+
+Screen::Screen(SDL_Renderer * render, Palette palette, Filter filter) : render(render), palette(palette), filter(filter),
+    scale(filterScale(filter)), uploads(0), rowsUploaded(0), presents(0), convertTime(0), worstConvert(0), stale(true) {
+
+    expand = expandScalar;
+    expandName = "scalar";
+
+#if EXPAND_SIMD_SUPPORTED
+    if (SDL_HasAVX2()) {
+
+        expand = expandAvx2;
+        expandName = "AVX2";
+
+    }
+    else if (SDL_HasSSE2()) {
+
+        expand = expandSse2;
+        expandName = "SSE2";
+
+    }
+#endif
+
+    //Anything around the display (when the window's aspect ratio doesn't match) is the background colour
+    SDL_SetRenderDrawColor(render, (palette.off >> 16) & 0xFF, (palette.off >> 8) & 0xFF, palette.off & 0xFF, 255);
+
+    //Keep the pixels sharp when the texture is stretched over the window
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    texture = SDL_CreateTexture(render, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH * scale,
+        DISPLAY_HEIGHT * scale);
+
+    if (texture == NULL) {
+
+        printf("Error creating SDL texture: %s\n", SDL_GetError());
+
+    }
+
+}
+
+Screen::~Screen() {
+
+    if (texture != NULL) {
+
+        SDL_DestroyTexture(texture);
+
+    }
+
+}
+
+bool Screen::valid() const {
+
+    return texture != NULL;
+
+}
+
+bool Screen::update(const uint64_t rows [DISPLAY_HEIGHT], uint32_t dirtyRows) {
+
+    if (texture == NULL) return false;
+
+    if (stale) {
+
+        dirtyRows = ALL_ROWS;
+        stale = false;
+
+    }
+    else {
+
+        //Drawing a sprite and then erasing it again (which is how most games animate) leaves the row as it was
+        for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+
+            if (rows[y] == shown[y]) dirtyRows &= ~(1u << y);
+
+        }
+
+    }
+
+    if (dirtyRows == 0) return false;
+
+    //Lock the band of rows from the first dirty one to the last. The locked pixels are write only so every row in the band
+    //has to be filled in, dirty or not
+    int first = 0, last = DISPLAY_HEIGHT - 1;
+
+    while (((dirtyRows >> first) & 1) == 0) first++;
+    while (((dirtyRows >> last) & 1) == 0) last--;
+
+    //Filters look at the rows above and below, so those come out differently too
+    if (filter != Filter::None) {
+
+        first = std::max(first - 1, 0);
+        last = std::min(last + 1, DISPLAY_HEIGHT - 1);
+
+    }
+
+    SDL_Rect band = {0, first * scale, DISPLAY_WIDTH * scale, (last - first + 1) * scale};
+    void * pixels;
+    int pitch;
+
+    if (SDL_LockTexture(texture, &band, &pixels, &pitch) != 0) {
+
+        printf("Error locking SDL texture: %s\n", SDL_GetError());
+        stale = true;
+        return false;
+
+    }
+
+    auto convertStart = std::chrono::steady_clock::now();
+    convertRows(rows, first, last + 1, (Uint8 *)pixels, pitch);
+
+    std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - convertStart;
+    convertTime += took;
+    worstConvert = std::max(worstConvert, took);
+    uploads++;
+    rowsUploaded += last - first + 1;
+
+    std::copy(rows + first, rows + last + 1, shown + first);
+    SDL_UnlockTexture(texture);
+    return true;
+
+}
+
+void Screen::convertRows(const uint64_t rows [DISPLAY_HEIGHT], int from, int to, Uint8 * pixels, int pitch) const {
+
+    if (filter == Filter::None) {
+
+        expand(rows + from, 1, to - from, pixels, pitch, palette);
+        return;
+
+    }
+
+    uint64_t scaled [MAX_FILTER_SCALE * MAX_FILTER_SCALE];
+
+    for (int y = from; y < to; y++) {
+
+        scaleRow(filter, rows, y, scaled);
+        expand(scaled, scale, scale, pixels + (y - from) * scale * pitch, pitch, palette);
+
+    }
+
+}
+
+void Screen::present() {
+
+    SDL_RenderClear(render);
+
+    if (texture != NULL) {
+
+        SDL_RenderCopy(render, texture, NULL, NULL);
+
+    }
+
+    SDL_RenderPresent(render);
+    presents++;
+
+}
+
+void Screen::invalidate() {
+
+    stale = true;
+
+}
+
+void Screen::printReport() const {
+
+    printf("Screen: %llu presents, %llu uploads averaging %.1f rows\n", presents, uploads,
+        (uploads > 0) ? (double)rowsUploaded / uploads : 0);
+    printf("    %s filter and %s pixel conversion took %.3f us per upload (worst %.3f us)\n", filterName(filter), expandName,
+        (uploads > 0) ? convertTime.count() / uploads : 0, worstConvert.count());
+
+}
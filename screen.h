@@ -0,0 +1,60 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "./SDL2/include/SDL.h"
+#include "chip8.h"
+#include "expand.h"
+#include "upscale.h"
+#include <chrono>
+
+//White on black
+const Palette DEFAULT_PALETTE = {0xFF000000, 0xFFFFFFFF};
+
+//Draws the CHIP-8 display to a window. The display is converted into a streaming texture (optionally upscaled by a pixel
+//art filter first) and that texture is stretched over the window, so a frame costs one upload, one copy and one present
+//no matter how many pixels changed. Only rows that differ from the ones already in the texture are converted and uploaded,
+//and a frame where none do doesn't need uploading or presenting at all
+class Screen {
+
+    public:
+        //The kernel that converts rows into pixels is the fastest one the CPU supports
+        Screen(SDL_Renderer * render, Palette palette = DEFAULT_PALETTE, Filter filter = Filter::None);
+        ~Screen();
+
+        //False if the texture couldn't be created. Nothing is drawn in that case
+        bool valid() const;
+        //Converts the rows in dirtyRows (one bit per pixel, leftmost pixel in the top bit) that differ from what's in the texture
+        //and uploads them. Rows outside dirtyRows are taken to be unchanged. Returns false if nothing had to be uploaded
+        bool update(const uint64_t rows [DISPLAY_HEIGHT], uint32_t dirtyRows = ALL_ROWS);
+        //Copies the texture over the window and presents it
+        void present();
+        //Makes the next update upload every row, for when the texture or the window lost its contents
+        void invalidate();
+        //Prints how many frames were uploaded and presented and how long filtering and converting them took
+        void printReport() const;
+
+    private:
+        //Filters and converts display rows from up to (not including) to into pixels, starting with the first pixel row
+        //of from
+        void convertRows(const uint64_t rows [DISPLAY_HEIGHT], int from, int to, Uint8 * pixels, int pitch) const;
+
+        SDL_Renderer * render;
+        SDL_Texture * texture;
+        Palette palette;
+        Filter filter;
+        int scale;
+        ExpandKernel expand;
+        const char * expandName;
+        unsigned long long uploads;
+        unsigned long long rowsUploaded;
+        unsigned long long presents;
+        //Time spent filtering and converting, in total and for the slowest upload
+        std::chrono::duration<double, std::micro> convertTime;
+        std::chrono::duration<double, std::micro> worstConvert;
+        //What's in the texture
+        uint64_t shown [DISPLAY_HEIGHT];
+        bool stale;
+
+};
+
+#endif
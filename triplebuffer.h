@@ -0,0 +1,60 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+//Hands values from one producer thread to one consumer thread without locks. The producer always has a buffer of its own
+//to fill, the consumer always has a buffer of its own to read, and the third is swapped between them. Neither side ever
+//waits on the other; the consumer just gets the newest value that was published and anything older is dropped
+template <class T>
+class TripleBuffer {
+
+    public:
+        TripleBuffer() : writeIndex(0), readIndex(1), shared(2) {
+
+        }
+
+        //The buffer the producer fills
+        T & back() {
+
+            return buffers[writeIndex];
+
+        }
+
+        //Makes the back buffer the newest value and gives the producer a new back buffer
+        void publish() {
+
+            writeIndex = shared.exchange(writeIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+
+        }
+
+        //Switches front() over to the newest published value. Returns false if nothing new was published since the last
+        //call, in which case front() stays as it was
+        bool update() {
+
+            if ((shared.load(std::memory_order_acquire) & FRESH) == 0) return false;
+
+            readIndex = shared.exchange(readIndex, std::memory_order_acq_rel) & INDEX;
+            return true;
+
+        }
+
+        //The buffer the consumer reads
+        const T & front() const {
+
+            return buffers[readIndex];
+
+        }
+
+    private:
+        //The shared index has this bit set when it holds a value the consumer hasn't seen yet
+        static const int FRESH = 4, INDEX = 3;
+
+        T buffers [3] {};
+        int writeIndex;
+        int readIndex;
+        std::atomic<int> shared;
+
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "upscale.h"
+
+//Bit n of a byte moved to bit 3n
+static unsigned int spread3 [256];
+
+static bool buildSpreadTable() {
+
+    for (int byte = 0; byte < 256; byte++) {
+
+        for (int bit = 0; bit < 8; bit++) {
+
+            if ((byte >> bit) & 1) {
+
+                spread3[byte] |= 1 << (3 * bit);
+
+            }
+
+        }
+
+    }
+
+    return true;
+
+}
+
+static const bool spreadTableBuilt = buildSpreadTable();
+
+//Bit n of a 32 bit value moved to bit 2n
+static uint64_t spread2(uint64_t bits) {
+
+    bits = (bits | (bits << 16)) & 0x0000FFFF0000FFFFULL;
+    bits = (bits | (bits << 8)) & 0x00FF00FF00FF00FFULL;
+    bits = (bits | (bits << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    bits = (bits | (bits << 2)) & 0x3333333333333333ULL;
+    bits = (bits | (bits << 1)) & 0x5555555555555555ULL;
+    return bits;
+
+}
+
+//The neighbour to the left and right of every pixel in a row. The edge pixels are their own neighbours
+static uint64_t leftOf(uint64_t row) {
+
+    return (row >> 1) | (row & (1ULL << 63));
+
+}
+
+static uint64_t rightOf(uint64_t row) {
+
+    return (row << 1) | (row & 1);
+
+}
+
+//Picks x where condition is set and e everywhere else
+static uint64_t select(uint64_t condition, uint64_t x, uint64_t e) {
+
+    return (condition & x) | (~condition & e);
+
+}
+
+//Writes the top count bits of bits into out at bit position, counting from the top bit of out[0]
+static void putBits(uint64_t * out, int position, uint64_t bits, int count) {
+
+    int word = position / 64;
+    int shift = 64 - position % 64 - count;
+
+    if (shift >= 0) {
+
+        out[word] |= bits << shift;
+
+    }
+    else {
+
+        out[word] |= bits >> -shift;
+        out[word + 1] |= bits << (64 + shift);
+
+    }
+
+}
+
+int filterScale(Filter filter) {
+
+    switch (filter) {
+
+        case Filter::Scale2x: return 2;
+        case Filter::Scale3x: return 3;
+        default: return 1;
+
+    }
+
+}
+
+const char * filterName(Filter filter) {
+
+    switch (filter) {
+
+        case Filter::Scale2x: return "Scale2x";
+        case Filter::Scale3x: return "Scale3x";
+        default: return "no";
+
+    }
+
+}
+
+void scaleRow(Filter filter, const uint64_t rows [DISPLAY_HEIGHT], int y, uint64_t * out) {
+
+    if (filter == Filter::None) {
+
+        out[0] = rows[y];
+        return;
+
+    }
+
+    //The 3x3 neighbourhood of every pixel in the row
+    //A B C
+    //D E F
+    //G H I
+    uint64_t b = rows[(y > 0) ? y - 1 : y];
+    uint64_t e = rows[y];
+    uint64_t h = rows[(y < DISPLAY_HEIGHT - 1) ? y + 1 : y];
+    uint64_t a = leftOf(b), c = rightOf(b), d = leftOf(e), f = rightOf(e), g = leftOf(h), i = rightOf(h);
+
+    //Set where the edge through each corner lines up
+    uint64_t topLeft = ~(d ^ b) & (b ^ f) & (d ^ h);
+    uint64_t topRight = ~(b ^ f) & (b ^ d) & (f ^ h);
+    uint64_t bottomLeft = ~(d ^ h) & (d ^ b) & (h ^ f);
+    uint64_t bottomRight = ~(h ^ f) & (d ^ h) & (b ^ f);
+
+    if (filter == Filter::Scale2x) {
+
+        uint64_t parts [2][2] = {
+            {select(topLeft, d, e), select(topRight, f, e)},
+            {select(bottomLeft, d, e), select(bottomRight, f, e)}
+        };
+
+        //Interleave the left and right pixels, one half of the row at a time
+        for (int row = 0; row < 2; row++) {
+
+            out[2 * row] = (spread2(parts[row][0] >> 32) << 1) | spread2(parts[row][1] >> 32);
+            out[2 * row + 1] = (spread2(parts[row][0] & 0xFFFFFFFF) << 1) | spread2(parts[row][1] & 0xFFFFFFFF);
+
+        }
+
+        return;
+
+    }
+
+    //Every output row, interleaved from 3 words that each hold one output pixel for every input pixel
+    uint64_t parts [3][3] = {
+        {select(topLeft, d, e), select((topLeft & (e ^ c)) | (topRight & (e ^ a)), b, e), select(topRight, f, e)},
+        {select((topLeft & (e ^ g)) | (bottomLeft & (e ^ a)), d, e), e,
+            select((topRight & (e ^ i)) | (bottomRight & (e ^ c)), f, e)},
+        {select(bottomLeft, d, e), select((bottomLeft & (e ^ i)) | (bottomRight & (e ^ g)), h, e), select(bottomRight, f, e)}
+    };
+
+    //Interleave a byte (8 input pixels) of each part at a time into 24 output pixels
+    for (int row = 0; row < 3; row++) {
+
+        uint64_t * line = out + row * 3;
+        line[0] = line[1] = line[2] = 0;
+
+        for (int byte = 0; byte < 8; byte++) {
+
+            int shift = 56 - 8 * byte;
+            uint64_t bits = 0;
+
+            for (int part = 0; part < 3; part++) {
+
+                bits |= (uint64_t)spread3[(parts[row][part] >> shift) & 0xFF] << (2 - part);
+
+            }
+
+            putBits(line, byte * 24, bits, 24);
+
+        }
+
+    }
+
+}
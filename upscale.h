@@ -0,0 +1,22 @@
+#ifndef UPSCALE_H
+#define UPSCALE_H
+
+#include "chip8.h"
+
+//Pixel art upscalers for the packed display. Scale2x and Scale3x (AdvMAME2x/3x) only add detail where two neighbouring
+//edges line up, so diagonals come out smooth without blurring anything. A display pixel only has two values, so every
+//comparison the filters make is an XOR of whole rows and each rule runs on all 64 pixels of a row at once
+enum class Filter { None, Scale2x, Scale3x };
+
+//Largest factor a filter scales by
+const int MAX_FILTER_SCALE = 3;
+
+//How many times wider and taller a filter makes the display
+int filterScale(Filter filter);
+//Printable name of a filter
+const char * filterName(Filter filter);
+//Scales row y of the display. Writes filterScale(filter) rows of filterScale(filter) words each to out, in the same
+//packed format as the display. Pixels past the edges count as copies of the edge pixels
+void scaleRow(Filter filter, const uint64_t rows [DISPLAY_HEIGHT], int y, uint64_t * out);
+
+#endif